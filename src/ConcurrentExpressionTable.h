@@ -0,0 +1,162 @@
+//==============================================================================
+// FILE:
+//    ConcurrentExpressionTable.h
+//
+// DESCRIPTION:
+//    Insert-only tables mapping expression strings to value numbers, shared
+//    by the threads of demo-gvn<parallel>. Two implementations with the same
+//    interface are provided:
+//      * ConcurrentExpressionTable: lock-free open addressing. A slot is
+//        claimed with a compare-and-swap of a pointer to an entry that the
+//        inserting thread has copied into its own arena.
+//      * LockedExpressionTable: a DenseMap behind a mutex, kept as the
+//        baseline of gvn-table-bench.
+//    Both draw new numbers from an atomic counter, so numbers are unique but
+//    their order depends on thread scheduling.
+//
+// License: MIT
+//==============================================================================
+
+#ifndef GVN_CONCURRENT_EXPRESSION_TABLE_H
+#define GVN_CONCURRENT_EXPRESSION_TABLE_H
+
+#include "llvm/ADT/CachedHashString.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/StringSaver.h"
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+//------------------------------------------------------------------------------
+// Lock-free table
+//------------------------------------------------------------------------------
+// The capacity is fixed at construction: the table never grows, so it must
+// be sized for every key that will be inserted (it is kept at most half
+// full to keep probe sequences short). Entries are never removed.
+//
+// getOrInsert takes the arena of the calling thread, which must outlive the
+// table. An entry is copied into that arena before it is published, and a
+// published entry is immutable, so readers never wait for a writer.
+class ConcurrentExpressionTable {
+public:
+  ConcurrentExpressionTable(unsigned FirstNumber, size_t MaxKeys)
+      : Mask(llvm::NextPowerOf2(2 * MaxKeys) - 1),
+        Slots(new std::atomic<const Entry *>[Mask + 1]),
+        NextNumber(FirstNumber) {
+    for (size_t I = 0; I <= Mask; ++I)
+      Slots[I].store(nullptr, std::memory_order_relaxed);
+  }
+
+  // Number of Key, which gets a new number if the table does not have it
+  unsigned getOrInsert(llvm::StringRef Key, llvm::BumpPtrAllocator &Arena,
+                       bool &Inserted) {
+    const size_t Hash = llvm::hash_value(Key);
+    const Entry *New = nullptr;
+    Inserted = false;
+    // Linear probing: a key can only be found before the first empty slot,
+    // since slots are filled in probe order and never cleared
+    for (size_t Idx = Hash & Mask, Probes = 0; Probes <= Mask;
+         Idx = (Idx + 1) & Mask, ++Probes) {
+      const Entry *E = Slots[Idx].load(std::memory_order_acquire);
+      if (!E) {
+        if (!New)
+          New = createEntry(Key, Hash, Arena);
+        if (Slots[Idx].compare_exchange_strong(E, New,
+                                               std::memory_order_acq_rel,
+                                               std::memory_order_acquire)) {
+          Inserted = true;
+          return New->Number;
+        }
+        // Another thread claimed the slot first, E is now its entry
+      }
+      if (E->Hash == Hash && E->getKey() == Key)
+        return E->Number;
+    }
+    llvm::report_fatal_error("demo-gvn: concurrent expression table is full");
+  }
+
+  unsigned takeNumber() {
+    return NextNumber.fetch_add(1, std::memory_order_relaxed);
+  }
+  unsigned getNextNumber() const {
+    return NextNumber.load(std::memory_order_relaxed);
+  }
+
+private:
+  // A key with its number. The characters of the key follow the entry in
+  // the arena.
+  struct Entry {
+    size_t Hash;
+    size_t Length;
+    unsigned Number;
+
+    llvm::StringRef getKey() const {
+      return llvm::StringRef(reinterpret_cast<const char *>(this + 1), Length);
+    }
+  };
+
+  // The number is taken before the entry is published, so a thread losing
+  // the race for a slot to the same key leaves a gap in the numbering. Gaps
+  // are harmless: only equality of numbers matters.
+  const Entry *createEntry(llvm::StringRef Key, size_t Hash,
+                           llvm::BumpPtrAllocator &Arena) {
+    void *Mem = Arena.Allocate(sizeof(Entry) + Key.size(), alignof(Entry));
+    Entry *E = new (Mem) Entry{Hash, Key.size(), takeNumber()};
+    if (!Key.empty())
+      std::memcpy(E + 1, Key.data(), Key.size());
+    return E;
+  }
+
+  const size_t Mask;
+  std::unique_ptr<std::atomic<const Entry *>[]> Slots;
+  std::atomic<unsigned> NextNumber;
+};
+
+//------------------------------------------------------------------------------
+// Mutex-guarded table
+//------------------------------------------------------------------------------
+// Same interface as ConcurrentExpressionTable. Keys are copied into the
+// table's own storage, the arena argument is not used.
+class LockedExpressionTable {
+public:
+  LockedExpressionTable(unsigned FirstNumber, size_t MaxKeys)
+      : NextNumber(FirstNumber) {
+    Numbers.reserve(MaxKeys);
+  }
+
+  unsigned getOrInsert(llvm::StringRef Key, llvm::BumpPtrAllocator &,
+                       bool &Inserted) {
+    llvm::CachedHashStringRef HashedKey(Key);
+    std::lock_guard<std::mutex> Lock(Mutex);
+    auto It = Numbers.find(HashedKey);
+    Inserted = It == Numbers.end();
+    if (!Inserted)
+      return It->second;
+    unsigned Number = takeNumber();
+    Numbers.try_emplace(
+        llvm::CachedHashStringRef(Saver.save(Key), HashedKey.hash()), Number);
+    return Number;
+  }
+
+  unsigned takeNumber() {
+    return NextNumber.fetch_add(1, std::memory_order_relaxed);
+  }
+  unsigned getNextNumber() const {
+    return NextNumber.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::mutex Mutex;
+  llvm::BumpPtrAllocator Allocator;
+  llvm::StringSaver Saver{Allocator};
+  llvm::DenseMap<llvm::CachedHashStringRef, unsigned> Numbers;
+  std::atomic<unsigned> NextNumber;
+};
+
+#endif // GVN_CONCURRENT_EXPRESSION_TABLE_H
@@ -18,21 +18,54 @@
 //==============================================================================
 
 #include "GVN.h"
+#include "ConcurrentExpressionTable.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/ScopedHashTable.h"
+#include "llvm/ADT/SetVector.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/BasicAliasAnalysis.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/Analysis/DomTreeUpdater.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/LoopIterator.h"
+#include "llvm/Analysis/MemoryLocation.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Analysis/ScopedNoAliasAA.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/TypeBasedAliasAnalysis.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Analysis/VectorUtils.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Dominators.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/VNCoercion.h"
+#include <atomic>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
 
 using namespace llvm;
@@ -42,6 +75,105 @@ using namespace llvm;
 // Statistics to track the effectiveness of the pass
 STATISTIC(NumGVNInstructions, "Number of instructions processed by GVN");
 STATISTIC(NumGVNRedundant, "Number of redundant instructions removed by GVN");
+STATISTIC(NumGVNLoadsForwarded,
+          "Number of loads forwarded from memset/memcpy by GVN");
+STATISTIC(NumGVNLoopHoisted,
+          "Number of loop-invariant expressions hoisted to a preheader by GVN");
+STATISTIC(NumGVNHoisted,
+          "Number of expressions hoisted from sibling branches by GVN");
+STATISTIC(NumGVNSunk, "Number of expressions sunk into a merge block by GVN");
+STATISTIC(NumGVNVectorOps,
+          "Number of vector element operations numbered as existing values");
+STATISTIC(NumGVNColdFunctions,
+          "Number of cold functions numbered in quick mode by GVN");
+STATISTIC(NumGVNImpliedConditions,
+          "Number of compares and branches folded by a dominating condition");
+STATISTIC(NumGVNSwitchCases,
+          "Number of uses of a switch value replaced by a case value by GVN");
+STATISTIC(NumGVNEngineValues,
+          "Number of values replaced by a numbering engine of GVN");
+STATISTIC(NumGVNEngineBranches,
+          "Number of branches folded by a numbering engine of GVN");
+STATISTIC(NumGVNParallelTasks,
+          "Number of dominator subtrees numbered in parallel by GVN");
+
+// Cost bound for moving code out of loops
+static cl::opt<unsigned> ProfitThreshold(
+    "demo-gvn-profit-threshold", cl::init(100), cl::Hidden,
+    cl::desc("Hoist out of a loop only if the frequency-weighted cost is at "
+             "most this percentage of the cost of the code it removes "
+             "(default = 100)"));
+
+// Whether loads with unrelated TBAA access types are kept apart
+static cl::opt<bool> SplitLoadsByTBAA(
+    "demo-gvn-tbaa-load-key", cl::init(false), cl::Hidden,
+    cl::desc("Include the TBAA access type in the key of a load, so that "
+             "merging two loads never drops their type-based alias "
+             "information (default = false)"));
+
+// Bound on the instructions inspected when looking for a load's clobber
+static cl::opt<unsigned> LoadScanLimit(
+    "demo-gvn-load-scan-limit", cl::init(100), cl::Hidden,
+    cl::desc("Maximum number of instructions scanned backwards to find the "
+             "write that clobbers a load (default = 100)"));
+
+// Bound on the dominating branch conditions tried per compare
+static cl::opt<unsigned> ConditionLimit(
+    "demo-gvn-condition-limit", cl::init(16), cl::Hidden,
+    cl::desc("Maximum number of dominating branch conditions checked for "
+             "one that implies a compare (default = 16)"));
+
+// Bounds on the fixpoint iterations of the numbering engines
+static cl::opt<unsigned> SCCPMaxSweeps(
+    "demo-gvn-sccp-max-sweeps", cl::init(20), cl::Hidden,
+    cl::desc("Maximum number of sweeps over a function by "
+             "demo-gvn<engine=sccp>; the engine gives up on functions "
+             "needing more (default = 20)"));
+
+static cl::opt<unsigned> SCCVNMaxIterations(
+    "demo-gvn-sccvn-max-iterations", cl::init(20), cl::Hidden,
+    cl::desc("Maximum number of optimistic iterations of a cycle by "
+             "demo-gvn<engine=sccvn>; cycles needing more are left "
+             "unnumbered (default = 20)"));
+
+// Parallel numbering, see numberSubtreesInParallel
+static cl::opt<unsigned> ParallelMinSize(
+    "demo-gvn-parallel-min-size", cl::init(10000), cl::Hidden,
+    cl::desc("Minimum number of instructions of a function numbered in "
+             "parallel with demo-gvn<parallel> (default = 10000)"));
+
+static cl::opt<unsigned> ParallelThreads(
+    "demo-gvn-threads", cl::init(0), cl::Hidden,
+    cl::desc("Number of threads used by demo-gvn<parallel> "
+             "(default = one per hardware thread)"));
+
+// Where the pass is added to the default pipelines built by PassBuilder
+enum class GVNExtensionPoint {
+  None,
+  ScalarOptimizerLate,
+  Peephole,
+  FullLTOLast
+};
+
+static cl::opt<GVNExtensionPoint> ExtensionPoint(
+    "demo-gvn-ep", cl::init(GVNExtensionPoint::ScalarOptimizerLate),
+    cl::desc("Extension point of the default pipelines to run demo-gvn at"),
+    cl::values(clEnumValN(GVNExtensionPoint::None, "none",
+                          "Only run when named in -passes="),
+               clEnumValN(GVNExtensionPoint::ScalarOptimizerLate, "scalar-late",
+                          "At the end of the function simplification "
+                          "pipeline (default)"),
+               clEnumValN(GVNExtensionPoint::Peephole, "peephole",
+                          "After every instcombine of the function "
+                          "simplification pipeline"),
+               clEnumValN(GVNExtensionPoint::FullLTOLast, "full-lto-last",
+                          "At the end of the full LTO pipeline")));
+
+// Options of the pass when added at an extension point
+static cl::opt<std::string> ExtensionPointParams(
+    "demo-gvn-ep-params", cl::init(""),
+    cl::desc("Parameters of demo-gvn when run at an extension point, in the "
+             "syntax of demo-gvn<...>, e.g. \"hoist;sink\""));
 
 namespace {
 // ValueNumber uniquely identifies a computed value
@@ -55,6 +187,23 @@ struct ValueHashInfo {
   static bool compare(const Value *LHS, const Value *RHS);
 };
 
+// Incoming value numbers of a PHI, computed once per PHI
+struct PHISignature {
+  // (incoming block, value number) pairs, sorted and without duplicates.
+  // Left empty when SingleValue is set, since the PHI then needs no
+  // expression of its own.
+  SmallVector<std::pair<BasicBlock *, ValueNumber>, 4> Incoming;
+  // Whether exactly one value number flows into the PHI, ignoring the PHI
+  // itself
+  bool SingleValue = false;
+  // The first incoming value other than the PHI itself
+  Value *FirstValue = nullptr;
+};
+
+// Number given to values whose numbering a parallel task leaves to the
+// serial walk
+constexpr ValueNumber DeferredNumber = ~0u;
+
 // Value expression table
 struct ValueTable {
   DenseMap<Value *, ValueNumber> valueNumbering;
@@ -62,15 +211,48 @@ struct ValueTable {
   DenseMap<ValueNumber, Value *> numberToValue;
   unsigned nextValueNumber;
 
-  ValueTable() : nextValueNumber(1) {}
+  // Alias queries for the current function; null means every write clobbers
+  BatchAAResults *BatchAA;
+  // Memory state observed by each load, see getMemoryState
+  DenseMap<LoadInst *, Value *> memoryStates;
+  // Signature of each PHI numbered so far, see getPHISignature
+  DenseMap<PHINode *, PHISignature> phiSignatures;
+  // Whether loads are numbered by the memory state they observe; otherwise
+  // every load gets a number of its own
+  bool NumberLoads = true;
+  // Dominator tree of the current function, used to tell unreachable code
+  // apart; null means every block is taken to be reachable
+  const DominatorTree *DT = nullptr;
+
+  // Set in the table of a parallel numbering task (see
+  // numberSubtreesInParallel): the task reads the numbers assigned before
+  // the split from Parent, agrees on expression numbers with the other tasks
+  // through Shared and records everything else locally. Deferred is raised
+  // when the value being numbered depends on one the task must not number.
+  // The keys a task adds to Shared live in its KeyArena.
+  const ValueTable *Parent = nullptr;
+  ConcurrentExpressionTable *Shared = nullptr;
+  BumpPtrAllocator KeyArena;
+  bool Deferred = false;
+
+  ValueTable() : nextValueNumber(1), BatchAA(nullptr) {}
 
   ValueNumber lookupOrAddValue(Value *V);
   std::string getExpressionString(Instruction *I);
-  bool areEqual(Value *V1, Value *V2);
+  const PHISignature &getPHISignature(PHINode *PN);
+  void appendShuffleExpression(ShuffleVectorInst *SVI, std::ostringstream &OS);
+  Value *getMemoryState(LoadInst *LI);
+  bool isClobberedBetween(const MemoryLocation &Loc, Instruction *From,
+                          Instruction *To);
+  bool clobbers(Instruction *I, const MemoryLocation &Loc);
+  ValueNumber createNumber(Value *V);
+  void mergeTask(ValueTable &Task);
   void clear() {
     valueNumbering.clear();
     expressionNumbering.clear();
     numberToValue.clear();
+    memoryStates.clear();
+    phiSignatures.clear();
     nextValueNumber = 1;
   }
 };
@@ -183,31 +365,50 @@ bool ValueHashInfo::compare(const Value *LHS, const Value *RHS) {
 std::string ValueTable::getExpressionString(Instruction *I) {
   std::ostringstream OS;
 
-  // Include the opcode
-  OS << I->getOpcode() << " ";
+  // Include the opcode and the result type. Operand numbers alone do not
+  // tell types apart, since null constants of every type are numbered 0.
+  OS << I->getOpcode() << " " << (uintptr_t)I->getType() << " ";
+
+  // Shuffles are keyed by their canonical form rather than their operands
+  if (ShuffleVectorInst *SVI = dyn_cast<ShuffleVectorInst>(I)) {
+    appendShuffleExpression(SVI, OS);
+    return OS.str();
+  }
 
   // Special handling for PHI nodes to capture their semantics
   if (PHINode *PN = dyn_cast<PHINode>(I)) {
-    // For PHI nodes, we need to incorporate both values and their source blocks
-    for (unsigned i = 0; i < PN->getNumIncomingValues(); ++i) {
-      Value *InVal = PN->getIncomingValue(i);
-      BasicBlock *InBB = PN->getIncomingBlock(i);
-
-      // Add value number and a hash of the block pointer
-      ValueNumber ValNum = lookupOrAddValue(InVal);
-      OS << ValNum << " " << (unsigned)(intptr_t)InBB << " ";
-    }
+    // For PHI nodes, we need to incorporate both values and their source
+    // blocks. The signature lists them sorted, so the order in which the
+    // incoming edges are listed does not matter.
+    for (const auto &In : getPHISignature(PN).Incoming)
+      OS << In.second << " " << (uintptr_t)In.first << " ";
   } else {
     // Normal handling for non-PHI instructions
-    // Add value numbers for each operand
+    // Add value numbers for each operand. Loads through differently typed
+    // pointers to the same address read the same bytes, so the pointer is
+    // numbered with casts stripped.
     for (const auto &Op : I->operands()) {
-      ValueNumber OpNum = lookupOrAddValue(Op);
+      Value *OpVal = Op;
+      if (isa<LoadInst>(I))
+        OpVal = OpVal->stripPointerCasts();
+      ValueNumber OpNum = lookupOrAddValue(OpVal);
       OS << OpNum << " ";
     }
 
-    // For Load instructions, include the address space
+    // For Load instructions, include the address space and the memory state
+    // the load observes
     if (LoadInst *LI = dyn_cast<LoadInst>(I)) {
-      OS << LI->getPointerAddressSpace() << " ";
+      OS << LI->getPointerAddressSpace() << " m"
+         << (uintptr_t)getMemoryState(LI) << " ";
+
+      // Merging loads with unrelated access types would leave the survivor
+      // without a TBAA tag, hiding it from type-based alias analysis in
+      // later passes. When that matters more than the extra load, key loads
+      // by their access type as well.
+      if (SplitLoadsByTBAA)
+        if (MDNode *Tag = LI->getMetadata(LLVMContext::MD_tbaa))
+          if (Tag->getNumOperands() >= 2)
+            OS << "t" << (uintptr_t)Tag->getOperand(1).get() << " ";
     }
 
     // For compare instructions, include the predicate
@@ -219,6 +420,147 @@ std::string ValueTable::getExpressionString(Instruction *I) {
   return OS.str();
 }
 
+// Describe a shuffle in a form shared by the different ways of writing it.
+// A splat is described by the scalar it repeats, however that scalar reaches
+// the shuffled vector. Other shuffles list their operands ordered by value
+// number, with the mask commuted to match, and leave out an operand the mask
+// does not read. Masks with undefined lanes are kept as they are: a shuffle
+// defining a lane may replace one leaving it undefined, but not the reverse.
+void ValueTable::appendShuffleExpression(ShuffleVectorInst *SVI,
+                                         std::ostringstream &OS) {
+  SmallVector<int, 16> Mask(SVI->getShuffleMask().begin(),
+                            SVI->getShuffleMask().end());
+  unsigned NumSrcElts =
+      cast<FixedVectorType>(SVI->getOperand(0)->getType())->getNumElements();
+
+  if (!Mask.empty() && Mask[0] >= 0 && is_splat(Mask)) {
+    Value *Src = SVI->getOperand(Mask[0] < (int)NumSrcElts ? 0 : 1);
+    unsigned Lane = Mask[0] % NumSrcElts;
+    if (Value *Scalar = findScalarElement(Src, Lane))
+      OS << "splat " << lookupOrAddValue(Scalar);
+    else
+      OS << "splat " << lookupOrAddValue(Src) << " " << Lane;
+    return;
+  }
+
+  bool UsesOp0 =
+      any_of(Mask, [&](int M) { return M >= 0 && M < (int)NumSrcElts; });
+  bool UsesOp1 = any_of(Mask, [&](int M) { return M >= (int)NumSrcElts; });
+  ValueNumber VN0 = UsesOp0 ? lookupOrAddValue(SVI->getOperand(0)) : 0;
+  ValueNumber VN1 = UsesOp1 ? lookupOrAddValue(SVI->getOperand(1)) : 0;
+  if (!UsesOp0 || (UsesOp1 && VN1 < VN0)) {
+    ShuffleVectorInst::commuteShuffleMask(Mask, NumSrcElts);
+    std::swap(VN0, VN1);
+    std::swap(UsesOp0, UsesOp1);
+  }
+
+  OS << VN0 << " ";
+  if (UsesOp1)
+    OS << VN1 << " ";
+  else
+    OS << "- ";
+  for (int M : Mask)
+    OS << M << ",";
+}
+
+// Vector operations that only move an existing value around are the value
+// they produce: an identity shuffle is its source, and extracting a lane
+// whose scalar is known, e.g. from an insertelement or a splat, is that
+// scalar. Returns null when the operation produces a new value.
+static Value *getRearrangedValue(Instruction *I) {
+  if (ShuffleVectorInst *SVI = dyn_cast<ShuffleVectorInst>(I)) {
+    ArrayRef<int> Mask = SVI->getShuffleMask();
+    if (!SVI->isIdentity() || all_of(Mask, [](int M) { return M < 0; }))
+      return nullptr;
+    int FirstLane = *find_if(Mask, [](int M) { return M >= 0; });
+    unsigned NumSrcElts =
+        cast<FixedVectorType>(SVI->getType())->getNumElements();
+    return SVI->getOperand(FirstLane < (int)NumSrcElts ? 0 : 1);
+  }
+
+  if (ExtractElementInst *EEI = dyn_cast<ExtractElementInst>(I)) {
+    ConstantInt *Idx = dyn_cast<ConstantInt>(EEI->getIndexOperand());
+    if (!Idx || Idx->getValue().uge(
+                    cast<FixedVectorType>(EEI->getVectorOperandType())
+                        ->getNumElements()))
+      return nullptr;
+    Value *Scalar =
+        findScalarElement(EEI->getVectorOperand(), Idx->getZExtValue());
+    return Scalar == I ? nullptr : Scalar;
+  }
+
+  return nullptr;
+}
+
+// Check whether an instruction may overwrite the given memory location.
+// Writes that alias analysis proves disjoint from Loc are skipped.
+bool ValueTable::clobbers(Instruction *I, const MemoryLocation &Loc) {
+  if (!I->mayWriteToMemory())
+    return false;
+  if (!BatchAA)
+    return true;
+  return isModSet(BatchAA->getModRefInfo(I, Loc));
+}
+
+// Find the memory state a load observes: the closest preceding instruction
+// that may write the loaded location, walking through single-predecessor
+// chains. Returns the block when the walk stops at a merge point, null when
+// the function entry is reached, and the load itself when the scan limit is
+// exceeded, so that the load only matches itself.
+Value *ValueTable::getMemoryState(LoadInst *LI) {
+  auto Cached = memoryStates.find(LI);
+  if (Cached != memoryStates.end())
+    return Cached->second;
+
+  MemoryLocation Loc = MemoryLocation::get(LI);
+  BasicBlock *BB = LI->getParent();
+  BasicBlock::iterator It = LI->getIterator();
+  unsigned Budget = LoadScanLimit;
+
+  while (true) {
+    while (It != BB->begin()) {
+      Instruction *I = &*--It;
+      if (Budget-- == 0)
+        return memoryStates[LI] = LI;
+      if (clobbers(I, Loc))
+        return memoryStates[LI] = I;
+    }
+
+    if (BB->isEntryBlock())
+      return memoryStates[LI] = nullptr;
+    BasicBlock *Pred = BB->getSinglePredecessor();
+    if (!Pred)
+      return memoryStates[LI] = BB;
+    BB = Pred;
+    It = BB->end();
+  }
+}
+
+// Check whether anything between From and To (both exclusive) may write Loc.
+// From must reach To through a chain of single-predecessor blocks; anything
+// else is conservatively treated as clobbered.
+bool ValueTable::isClobberedBetween(const MemoryLocation &Loc,
+                                    Instruction *From, Instruction *To) {
+  BasicBlock *BB = To->getParent();
+  BasicBlock::iterator It = To->getIterator();
+  unsigned Budget = LoadScanLimit;
+
+  while (true) {
+    while (It != BB->begin()) {
+      Instruction *I = &*--It;
+      if (I == From)
+        return false;
+      if (Budget-- == 0 || clobbers(I, Loc))
+        return true;
+    }
+
+    BB = BB->getSinglePredecessor();
+    if (!BB)
+      return true;
+    It = BB->end();
+  }
+}
+
 // Look up a value's number or assign a new one
 ValueNumber ValueTable::lookupOrAddValue(Value *V) {
   // Constants always get the same number
@@ -231,15 +573,77 @@ ValueNumber ValueTable::lookupOrAddValue(Value *V) {
   auto It = valueNumbering.find(V);
   if (It != valueNumbering.end())
     return It->second;
+  if (Parent) {
+    auto ParentIt = Parent->valueNumbering.find(V);
+    if (ParentIt != Parent->valueNumbering.end())
+      return ParentIt->second;
+  }
 
   // Handle instructions specially
   if (Instruction *I = dyn_cast<Instruction>(V)) {
+    // A PHI may merge values of sibling dominator subtrees, and simplifying
+    // vector operations may create constants in the shared context. Parallel
+    // tasks leave both, and whatever uses them, to the serial walk.
+    if (Parent && (isa<PHINode>(I) || isa<ShuffleVectorInst>(I) ||
+                   isa<ExtractElementInst>(I) || isa<InsertElementInst>(I))) {
+      Deferred = true;
+      return DeferredNumber;
+    }
+
+    // Unreachable code never executes and may even use itself without a PHI,
+    // e.g. %x = add i32 %x, 1. It gets a number of its own without looking
+    // at its operands.
+    if (DT && !DT->isReachableFromEntry(I->getParent()))
+      goto CreateNewNumber;
+
     // Skip instructions we don't handle
-    if (!I->isBinaryOp() && !isa<CmpInst>(I) && !isa<LoadInst>(I) && !isa<PHINode>(I))
+    if (!I->isBinaryOp() && !isa<CmpInst>(I) && !isa<LoadInst>(I) &&
+        !isa<PHINode>(I) && !isa<ShuffleVectorInst>(I) &&
+        !isa<ExtractElementInst>(I) && !isa<InsertElementInst>(I))
       goto CreateNewNumber;
 
+    // Scalable vectors have no fixed lanes to reason about
+    if (isa<ShuffleVectorInst>(I) || isa<ExtractElementInst>(I) ||
+        isa<InsertElementInst>(I)) {
+      Value *Vec = isa<InsertElementInst>(I) ? I : I->getOperand(0);
+      if (isa<ScalableVectorType>(Vec->getType()))
+        goto CreateNewNumber;
+
+      if (Value *Same = getRearrangedValue(I)) {
+        ValueNumber VN = lookupOrAddValue(Same);
+        valueNumbering[V] = VN;
+        ++NumGVNVectorOps;
+        return VN;
+      }
+    }
+
+    // Volatile and atomic loads never match another load
+    if (LoadInst *LI = dyn_cast<LoadInst>(I))
+      if (!LI->isSimple() || !NumberLoads)
+        goto CreateNewNumber;
+
+    // A PHI in a loop is reached again through its own incoming values.
+    // Give it a provisional number first so that the recursion terminates.
+    ValueNumber Provisional = 0;
+    if (PHINode *PN = dyn_cast<PHINode>(I)) {
+      Provisional = nextValueNumber++;
+      valueNumbering[V] = Provisional;
+      numberToValue[Provisional] = V;
+
+      // A PHI merging a single value number on every edge is that value
+      const PHISignature &Sig = getPHISignature(PN);
+      if (Sig.SingleValue) {
+        Value *Common = Sig.FirstValue;
+        ValueNumber VN = lookupOrAddValue(Common);
+        valueNumbering[V] = VN;
+        return VN;
+      }
+    }
+
     // Create expression string and check if we've seen it before
     std::string Expression = getExpressionString(I);
+    if (Deferred)
+      return DeferredNumber;
     auto ExprIt = expressionNumbering.find(Expression);
     if (ExprIt != expressionNumbering.end()) {
       ValueNumber VN = ExprIt->second;
@@ -247,8 +651,24 @@ ValueNumber ValueTable::lookupOrAddValue(Value *V) {
       return VN;
     }
 
+    // Parallel tasks look in the table numbered before the split, then in
+    // the table shared with the other tasks
+    if (Parent) {
+      auto ParentIt = Parent->expressionNumbering.find(Expression);
+      bool Inserted = false;
+      ValueNumber VN =
+          ParentIt != Parent->expressionNumbering.end()
+              ? ParentIt->second
+              : Shared->getOrInsert(Expression, KeyArena, Inserted);
+      expressionNumbering[Expression] = VN;
+      valueNumbering[V] = VN;
+      if (Inserted)
+        numberToValue[VN] = V;
+      return VN;
+    }
+
     // New expression, assign a new number
-    ValueNumber VN = nextValueNumber++;
+    ValueNumber VN = Provisional ? Provisional : nextValueNumber++;
     expressionNumbering[Expression] = VN;
     valueNumbering[V] = VN;
     numberToValue[VN] = V;
@@ -257,29 +677,1647 @@ ValueNumber ValueTable::lookupOrAddValue(Value *V) {
 
 CreateNewNumber:
   // Assign new number for this value
-  ValueNumber VN = nextValueNumber++;
+  ValueNumber VN = createNumber(V);
   valueNumbering[V] = VN;
   numberToValue[VN] = V;
   return VN;
 }
 
-// Check if two values compute the same result
-bool ValueTable::areEqual(Value *V1, Value *V2) {
-  return lookupOrAddValue(V1) == lookupOrAddValue(V2);
+// Number a value that is not an expression. Parallel tasks take numbers from
+// the shared counter. Values other than instructions may be met by several
+// tasks, so they are keyed by address in the shared table.
+ValueNumber ValueTable::createNumber(Value *V) {
+  if (!Shared)
+    return nextValueNumber++;
+  if (isa<Instruction>(V))
+    return Shared->takeNumber();
+  bool Inserted;
+  return Shared->getOrInsert("v" + utohexstr((uintptr_t)V), KeyArena,
+                             Inserted);
+}
+
+// Take over what a parallel task numbered
+void ValueTable::mergeTask(ValueTable &Task) {
+  for (const auto &Entry : Task.valueNumbering)
+    valueNumbering.insert(Entry);
+  for (const auto &Entry : Task.numberToValue)
+    numberToValue.insert(Entry);
+  for (const auto &Entry : Task.memoryStates)
+    memoryStates.insert(Entry);
+  for (const auto &Entry : Task.expressionNumbering)
+    expressionNumbering.insert(Entry);
+}
+
+// Number every incoming value of a PHI once and summarize the result. PHIs
+// from lowered switches can have thousands of inputs, most of them repeating
+// a handful of values, so consecutive repeats of a value are not looked up
+// again. Whether the inputs share one number is decided in the same linear
+// pass, comparing each number with the first one until they differ. Only a
+// PHI with several distinct inputs sorts its pairs, to build its expression.
+const PHISignature &ValueTable::getPHISignature(PHINode *PN) {
+  auto Cached = phiSignatures.find(PN);
+  if (Cached != phiSignatures.end())
+    return Cached->second;
+
+  PHISignature Sig;
+  Sig.Incoming.reserve(PN->getNumIncomingValues());
+
+  Value *PrevVal = nullptr;
+  ValueNumber PrevVN = 0, FirstVN = 0;
+  bool Varying = false;
+  for (unsigned i = 0; i < PN->getNumIncomingValues(); ++i) {
+    // Values flowing in along edges from unreachable blocks never reach the
+    // PHI
+    if (DT && !DT->isReachableFromEntry(PN->getIncomingBlock(i)))
+      continue;
+
+    Value *InVal = PN->getIncomingValue(i);
+    if (InVal != PrevVal) {
+      PrevVal = InVal;
+      PrevVN = lookupOrAddValue(InVal);
+    }
+    Sig.Incoming.push_back({PN->getIncomingBlock(i), PrevVN});
+    if (InVal == PN)
+      continue;
+    if (!Sig.FirstValue) {
+      Sig.FirstValue = InVal;
+      FirstVN = PrevVN;
+    } else if (!Varying && PrevVN != FirstVN) {
+      Varying = true;
+    }
+  }
+
+  Sig.SingleValue = Sig.FirstValue && !Varying;
+  if (Sig.SingleValue) {
+    Sig.Incoming.clear();
+  } else {
+    llvm::sort(Sig.Incoming);
+    Sig.Incoming.erase(std::unique(Sig.Incoming.begin(), Sig.Incoming.end()),
+                       Sig.Incoming.end());
+  }
+
+  // Numbering the incoming values may have computed the signature already,
+  // when they lead back to this PHI
+  return phiSignatures[PN] = std::move(Sig);
+}
+
+//------------------------------------------------------------------------------
+// Memory intrinsic forwarding
+//------------------------------------------------------------------------------
+// Try to compute the value of a load whose memory state is a memset or memcpy
+// without reading the clobbered memory. A memset yields its splatted byte
+// value, a memcpy is rewritten into a load of the corresponding source bytes
+// inserted right before the original load. Returns null when the load cannot
+// be answered from the intrinsic.
+static Value *forwardFromMemIntrinsic(LoadInst *LI, MemIntrinsic *MI,
+                                      ValueTable &VT, const DataLayout &DL,
+                                      bool AllowInsertion) {
+  if (MI->isVolatile())
+    return nullptr;
+
+  Type *LoadTy = LI->getType();
+  Value *LoadPtr = LI->getPointerOperand();
+
+  // Memsets and memcpys from constant memory are handled by the same
+  // coercion helpers LLVM's GVN uses
+  int Offset =
+      VNCoercion::analyzeLoadFromClobberingMemInst(LoadTy, LoadPtr, MI, DL);
+  if (Offset >= 0) {
+    if (Constant *C =
+            VNCoercion::getConstantMemInstValueForLoad(MI, Offset, LoadTy, DL))
+      return C;
+    if (isa<MemSetInst>(MI) && AllowInsertion)
+      return VNCoercion::getMemInstValueForLoad(MI, Offset, LoadTy, LI, DL);
+    return nullptr;
+  }
+
+  // Any other memcpy: the load must read a fixed range of the copied bytes.
+  // Memmove is not handled since its source may overlap the destination.
+  MemCpyInst *MCI = dyn_cast<MemCpyInst>(MI);
+  if (!MCI || !AllowInsertion)
+    return nullptr;
+  ConstantInt *Len = dyn_cast<ConstantInt>(MCI->getLength());
+  TypeSize LoadSize = DL.getTypeStoreSize(LoadTy);
+  if (!Len || LoadSize.isScalable())
+    return nullptr;
+
+  int64_t LoadOffset = 0, DestOffset = 0;
+  Value *LoadBase = GetPointerBaseWithConstantOffset(LoadPtr, LoadOffset, DL);
+  Value *DestBase =
+      GetPointerBaseWithConstantOffset(MCI->getDest(), DestOffset, DL);
+  if (LoadBase != DestBase)
+    return nullptr;
+
+  int64_t SrcOffset = LoadOffset - DestOffset;
+  if (SrcOffset < 0 ||
+      (uint64_t)SrcOffset + LoadSize.getFixedSize() > Len->getZExtValue())
+    return nullptr;
+
+  // The source bytes must still hold the copied values at the load
+  if (VT.isClobberedBetween(MemoryLocation::getForSource(MCI), MCI, LI))
+    return nullptr;
+
+  IRBuilder<> Builder(LI);
+  Value *SrcPtr = Builder.CreateConstInBoundsGEP1_64(
+      Builder.getInt8Ty(), MCI->getRawSource(), SrcOffset);
+  SrcPtr = Builder.CreateBitCast(
+      SrcPtr, LoadTy->getPointerTo(MCI->getSourceAddressSpace()));
+  LoadInst *NewLoad = Builder.CreateAlignedLoad(
+      LoadTy, SrcPtr,
+      commonAlignment(MCI->getSourceAlign().valueOrOne(), SrcOffset),
+      LI->getName() + ".fwd");
+  NewLoad->setDebugLoc(LI->getDebugLoc());
+  return NewLoad;
 }
 
 //------------------------------------------------------------------------------
 // GVN Implementation
 //------------------------------------------------------------------------------
+namespace {
+// Leaders of the value numbers available in the current dominator scope
+using LeaderTable = ScopedHashTable<ValueNumber, Value *>;
+
+// A dominator tree node on the walk stack, together with the leader scope of
+// its block and the next child to visit. The branch conditions known in the
+// block are the first NumConditions entries of the walk's condition stack,
+// of which the first ParentConditions are known in its parent.
+struct DomScope {
+  DomTreeNode *Node;
+  DomTreeNode::const_iterator NextChild;
+  ScopedHashTableScope<ValueNumber, Value *> Scope;
+  bool Visited = false;
+  size_t ParentConditions;
+  size_t NumConditions = 0;
+
+  DomScope(LeaderTable &Leaders, DomTreeNode *N, size_t ParentConditions = 0)
+      : Node(N), NextChild(N->begin()), Scope(Leaders),
+        ParentConditions(ParentConditions) {}
+};
+
+// A fact known on every path into a dominator subtree: the branch condition
+// Cond has the value IsTrue or, below the default edge of the switch
+// DefaultOf on Cond, Cond differs from every case value of that switch
+struct DominatingCondition {
+  Value *Cond;
+  bool IsTrue;
+  SwitchInst *DefaultOf = nullptr;
+};
+} // anonymous namespace
+
+// The leader of VN in scope, if it has type Ty. Values of different types
+// can share a number: every null constant is numbered 0, so two operations
+// on null operands get the same expression.
+static Value *lookupLeader(const LeaderTable &Leaders, ValueNumber VN,
+                           Type *Ty) {
+  Value *Leader = Leaders.lookup(VN);
+  return Leader && Leader->getType() == Ty ? Leader : nullptr;
+}
+
+// The case value of SI leading to BB, if BB can only be entered from SI
+// through the edge of that single case
+static ConstantInt *getUniqueCaseValue(SwitchInst *SI, BasicBlock *BB,
+                                       const DominatorTree &DT) {
+  if (isa<Constant>(SI->getCondition()) || BB == SI->getDefaultDest())
+    return nullptr;
+  ConstantInt *CaseValue = SI->findCaseDest(BB);
+  if (!CaseValue || !DT.dominates(BasicBlockEdge(SI->getParent(), BB), BB))
+    return nullptr;
+  return CaseValue;
+}
+
+// Add the conditions known in BB because every path from its immediate
+// dominator Pred to BB leaves Pred through the same edge of a conditional
+// branch, or through the default edge of a switch
+static void
+addEdgeConditions(BasicBlock *Pred, BasicBlock *BB, const DominatorTree &DT,
+                  SmallVectorImpl<DominatingCondition> &Conditions) {
+  if (auto *SI = dyn_cast<SwitchInst>(Pred->getTerminator())) {
+    if (isa<Constant>(SI->getCondition()) ||
+        !DT.dominates(BasicBlockEdge(Pred, SI->getDefaultDest()), BB))
+      return;
+    // One entry for all the cases, so that a large switch does not use up
+    // the budget of getImpliedCondition
+    Conditions.push_back({SI->getCondition(), false, SI});
+    return;
+  }
+
+  auto *BI = dyn_cast<BranchInst>(Pred->getTerminator());
+  if (!BI || !BI->isConditional() || isa<Constant>(BI->getCondition()) ||
+      BI->getSuccessor(0) == BI->getSuccessor(1))
+    return;
+  for (unsigned Idx = 0; Idx < 2; ++Idx)
+    if (DT.dominates(BasicBlockEdge(Pred, BI->getSuccessor(Idx)), BB))
+      Conditions.push_back({BI->getCondition(), Idx == 0});
+}
+
+// Value of an equality compare of the condition of SI against one of its
+// case values, below the default edge of SI
+static Optional<bool> getImpliedByDefaultEdge(Value *Cond, SwitchInst *SI) {
+  auto *Cmp = dyn_cast<ICmpInst>(Cond);
+  if (!Cmp || !Cmp->isEquality())
+    return None;
+  Value *LHS = Cmp->getOperand(0), *RHS = Cmp->getOperand(1);
+  if (RHS == SI->getCondition())
+    std::swap(LHS, RHS);
+  auto *CaseValue = dyn_cast<ConstantInt>(RHS);
+  if (LHS != SI->getCondition() || !CaseValue ||
+      SI->findCaseValue(CaseValue) == SI->case_default())
+    return None;
+  return Cmp->getPredicate() == ICmpInst::ICMP_NE;
+}
+
+// Value of Cond implied by one of the dominating conditions, innermost first
+static Optional<bool>
+getImpliedCondition(Value *Cond, ArrayRef<DominatingCondition> Conditions,
+                    const DataLayout &DL) {
+  unsigned Budget = ConditionLimit;
+  for (const DominatingCondition &DC : llvm::reverse(Conditions)) {
+    if (!Budget--)
+      break;
+    Optional<bool> Implied =
+        DC.DefaultOf ? getImpliedByDefaultEdge(Cond, DC.DefaultOf)
+                     : isImpliedCondition(DC.Cond, Cond, DL, DC.IsTrue);
+    if (Implied)
+      return Implied;
+  }
+  return None;
+}
+
+// Replace the uses of a switch value that are only reached through the edge
+// of a single case with the case value, so that code specialized to the case
+// folds to constants
+static bool propagateSwitchCases(Function &F, DominatorTree &DT,
+                                 bool Verbose) {
+  bool Changed = false;
+  for (BasicBlock &BB : F) {
+    auto *SI = dyn_cast<SwitchInst>(BB.getTerminator());
+    if (!SI || !DT.isReachableFromEntry(&BB))
+      continue;
+    for (const auto &Case : SI->cases()) {
+      BasicBlock *Dest = Case.getCaseSuccessor();
+      if (getUniqueCaseValue(SI, Dest, DT) != Case.getCaseValue())
+        continue;
+      unsigned NumReplaced =
+          replaceDominatedUsesWith(SI->getCondition(), Case.getCaseValue(), DT,
+                                   BasicBlockEdge(&BB, Dest));
+      if (!NumReplaced)
+        continue;
+      if (Verbose)
+        llvm::outs() << "Replaced " << NumReplaced << " uses of "
+                     << SI->getCondition()->getName() << " with "
+                     << *Case.getCaseValue() << " below case edge to "
+                     << Dest->getName() << "\n";
+      NumGVNSwitchCases += NumReplaced;
+      Changed = true;
+    }
+  }
+  return Changed;
+}
+
+// Follow a chain of replacements to the value that finally survives
+static Value *
+getFinalReplacement(Value *V,
+                    const DenseMap<Instruction *, Value *> &replacements) {
+  while (Instruction *I = dyn_cast<Instruction>(V)) {
+    auto It = replacements.find(I);
+    if (It == replacements.end())
+      break;
+    V = It->second;
+  }
+  return V;
+}
+
+// The constant computed by I when each of its operands is one, looking
+// through the replacements already decided
+static Constant *
+foldToConstant(Instruction *I,
+               const DenseMap<Instruction *, Value *> &replacements,
+               const DataLayout &DL) {
+  if (!I->isBinaryOp() && !isa<CmpInst>(I) && !isa<CastInst>(I) &&
+      !isa<SelectInst>(I) && !isa<GetElementPtrInst>(I))
+    return nullptr;
+  SmallVector<Constant *, 4> Ops;
+  for (Value *Op : I->operands()) {
+    auto *C = dyn_cast<Constant>(getFinalReplacement(Op, replacements));
+    if (!C)
+      return nullptr;
+    Ops.push_back(C);
+  }
+  if (auto *Cmp = dyn_cast<CmpInst>(I))
+    return ConstantFoldCompareInstOperands(Cmp->getPredicate(), Ops[0], Ops[1],
+                                           DL);
+  return ConstantFoldInstOperands(I, Ops, DL);
+}
+
+//------------------------------------------------------------------------------
+// Debug info
+//------------------------------------------------------------------------------
+// Erase an instruction whose uses are gone. Debug intrinsics still referring
+// to it are rewritten in terms of its operands where possible, and marked
+// undef otherwise. Most erased instructions had their debug users moved by
+// replaceAllUsesWith already, so the metadata-use check keeps the common
+// case free of the debug user lookup.
+static void salvageDebugInfoAndErase(Instruction *I) {
+  if (I->isUsedByMetadata())
+    salvageDebugInfo(*I);
+  I->eraseFromParent();
+}
+
+// An instruction standing in for copies at other source locations, because
+// it was hoisted or sunk, gets a location merged from all of them. Stepping
+// through the merged code then does not attribute it to one arm only.
+static void mergeDebugLocations(Instruction *Merged,
+                                ArrayRef<Instruction *> Copies) {
+  for (Instruction *Copy : Copies)
+    Merged->applyMergedLocation(Merged->getDebugLoc(), Copy->getDebugLoc());
+}
+
+//------------------------------------------------------------------------------
+// Profitability
+//------------------------------------------------------------------------------
+namespace {
+// Weighs moving computations out of loops by the estimated execution
+// frequency of the blocks involved. With profile data the estimates come
+// from the profile, otherwise from static heuristics. The other stages
+// never make code run more often and are not weighed.
+struct ProfitabilityModel {
+  BlockFrequencyInfo &BFI;
+
+  ProfitabilityModel(BlockFrequencyInfo &BFI) : BFI(BFI) {}
+
+  double getFrequency(const BasicBlock *BB) const {
+    return BFI.getBlockFreq(BB).getFrequency();
+  }
+
+  // Check a transformation replacing code of weighted cost OldCost by code
+  // of weighted cost NewCost against the threshold
+  bool isProfitable(double OldCost, double NewCost) const {
+    return NewCost * 100 <= OldCost * ProfitThreshold;
+  }
+};
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+// Loop-invariant hoisting
+//------------------------------------------------------------------------------
+// Check whether an instruction may be executed in a loop preheader
+static bool isLoopHoistCandidate(Instruction &I) {
+  if (!I.isBinaryOp() && !isa<CmpInst>(I))
+    return false;
+  return isSafeToSpeculativelyExecute(&I);
+}
+
+// Hoist loop-invariant expressions the value table found congruent in several
+// places of a loop body to the loop preheader. One copy moves to the
+// preheader and the other copies are replaced by it, so the loop computes the
+// value once per entry instead of once per iteration. Inner loops are visited
+// first, letting an expression move out one loop level at a time.
+static bool
+hoistLoopInvariantCongruences(LoopInfo &LI, ValueTable &VT,
+                              const ProfitabilityModel &Profit,
+                              SmallPtrSetImpl<Instruction *> &toRemove,
+                              DenseMap<Instruction *, Value *> &replacements,
+                              bool Verbose) {
+  bool Changed = false;
+
+  // The loop list must outlive the walk: reverse() only keeps its iterators
+  SmallVector<Loop *, 4> Loops = LI.getLoopsInPreorder();
+  for (Loop *L : reverse(Loops)) {
+    BasicBlock *Preheader = L->getLoopPreheader();
+    if (!Preheader)
+      continue;
+
+    // Group the surviving candidates by value number, in reverse post-order
+    // so that the operands of an expression are grouped before it
+    LoopBlocksRPO RPOT(L);
+    RPOT.perform(&LI);
+    MapVector<ValueNumber, SmallVector<Instruction *, 4>> Groups;
+    for (BasicBlock *BB : RPOT)
+      for (Instruction &I : *BB)
+        if (!toRemove.count(&I) && isLoopHoistCandidate(I))
+          Groups[VT.lookupOrAddValue(&I)].push_back(&I);
+
+    for (auto &Group : Groups) {
+      SmallVectorImpl<Instruction *> &Copies = Group.second;
+      if (Copies.size() < 2)
+        continue;
+
+      // Operands are looked at through pending replacements, since an
+      // operand may be a copy that was just hoisted out of this loop
+      Instruction *Hoisted = Copies.front();
+      bool Invariant = all_of(Hoisted->operands(), [&](Value *Op) {
+        return L->isLoopInvariant(getFinalReplacement(Op, replacements));
+      });
+      if (!Invariant)
+        continue;
+
+      // A preheader hotter than the copies, e.g. when they sit in a rarely
+      // taken branch of a rarely iterating loop, would pessimize the loop
+      double OldCost = 0;
+      for (Instruction *Copy : Copies)
+        OldCost += Profit.getFrequency(Copy->getParent());
+      if (!Profit.isProfitable(OldCost, Profit.getFrequency(Preheader))) {
+        if (Verbose)
+          llvm::outs() << "Not hoisting unprofitable expression: " << *Hoisted
+                       << "\n";
+        continue;
+      }
+
+      if (Verbose)
+        llvm::outs() << "Hoisting loop-invariant expression: " << *Hoisted
+                     << "\n  To preheader: " << Preheader->getName() << "\n";
+      for (Use &Op : Hoisted->operands())
+        Op.set(getFinalReplacement(Op, replacements));
+      Hoisted->moveBefore(Preheader->getTerminator());
+      mergeDebugLocations(Hoisted, makeArrayRef(Copies).drop_front());
+
+      for (Instruction *Copy : drop_begin(Copies)) {
+        Hoisted->andIRFlags(Copy);
+        toRemove.insert(Copy);
+        replacements[Copy] = Hoisted;
+        ++NumGVNRedundant;
+      }
+      ++NumGVNLoopHoisted;
+      Changed = true;
+    }
+  }
+
+  return Changed;
+}
+
+//------------------------------------------------------------------------------
+// Sibling-branch hoisting
+//------------------------------------------------------------------------------
+// Collect, for one successor of a branch, the first surviving copy of each
+// value number that may be hoisted to the end of the branching block. An
+// instruction that is not safe to speculate only qualifies while every
+// instruction before it is known to reach it. A load additionally must not
+// be clobbered inside the successor.
+static void
+collectHoistCandidates(BasicBlock *Succ, ValueTable &VT,
+                       const SmallPtrSetImpl<Instruction *> &toRemove,
+                       MapVector<ValueNumber, Instruction *> &Candidates) {
+  bool Reached = true;
+  for (Instruction &I : *Succ) {
+    if (I.isTerminator())
+      break;
+    bool Eligible = !toRemove.count(&I) && !isa<PHINode>(I) &&
+                    (I.isBinaryOp() || isa<CmpInst>(I) || isa<LoadInst>(I));
+    if (LoadInst *LI = dyn_cast<LoadInst>(&I)) {
+      Value *State = LI->isSimple() ? VT.getMemoryState(LI) : LI;
+      Instruction *Clobber = dyn_cast_or_null<Instruction>(State);
+      if (State == Succ || (Clobber && Clobber->getParent() == Succ))
+        Eligible = false;
+    }
+    if (Eligible && (Reached || isSafeToSpeculativelyExecute(&I)))
+      Candidates.insert({VT.lookupOrAddValue(&I), &I});
+    Reached &= isGuaranteedToTransferExecutionToSuccessor(&I);
+  }
+}
+
+// When every successor of a branch computes the same value, neither copy
+// dominates the others and the main walk cannot remove them. Hoist one copy
+// to the end of the branching block and replace the others with it. Blocks
+// are visited bottom-up so that a value can climb several branch levels.
+// The branching block is the single predecessor of every successor, so the
+// hoisted copy never runs more often than the copies it replaces and the
+// move needs no frequency check.
+static bool
+hoistFromSiblingBranches(DominatorTree &DT, ValueTable &VT,
+                         SmallPtrSetImpl<Instruction *> &toRemove,
+                         DenseMap<Instruction *, Value *> &replacements,
+                         bool Verbose) {
+  bool Changed = false;
+
+  for (DomTreeNode *Node : post_order(DT.getRootNode())) {
+    BasicBlock *BB = Node->getBlock();
+    Instruction *Term = BB->getTerminator();
+    if (!isa<BranchInst>(Term) && !isa<SwitchInst>(Term))
+      continue;
+
+    // Every successor must be entered only from this block
+    SmallVector<BasicBlock *, 4> Succs;
+    for (BasicBlock *Succ : successors(BB))
+      if (!is_contained(Succs, Succ))
+        Succs.push_back(Succ);
+    if (Succs.size() < 2 || any_of(Succs, [&](BasicBlock *Succ) {
+          return Succ->getSinglePredecessor() != BB;
+        }))
+      continue;
+
+    SmallVector<MapVector<ValueNumber, Instruction *>, 4> Candidates(
+        Succs.size());
+    for (unsigned i = 0; i < Succs.size(); ++i)
+      collectHoistCandidates(Succs[i], VT, toRemove, Candidates[i]);
+
+    // Candidates of the first successor are visited in program order, so an
+    // operand computed in the successor is hoisted before its users
+    for (auto &Entry : Candidates[0]) {
+      Instruction *Hoisted = Entry.second;
+      SmallVector<Instruction *, 4> Copies;
+      for (unsigned i = 1; i < Succs.size(); ++i) {
+        Instruction *Copy = Candidates[i].lookup(Entry.first);
+        if (!Copy)
+          break;
+        Copies.push_back(Copy);
+      }
+      if (Copies.size() + 1 != Succs.size())
+        continue;
+
+      bool Available = all_of(Hoisted->operands(), [&](Value *Op) {
+        Instruction *OpInst =
+            dyn_cast<Instruction>(getFinalReplacement(Op, replacements));
+        return !OpInst || DT.dominates(OpInst, Term);
+      });
+      if (!Available)
+        continue;
+
+      if (Verbose)
+        llvm::outs() << "Hoisting expression from sibling branches: "
+                     << *Hoisted << "\n  To block: " << BB->getName() << "\n";
+      for (Use &Op : Hoisted->operands())
+        Op.set(getFinalReplacement(Op, replacements));
+      Hoisted->moveBefore(Term);
+      mergeDebugLocations(Hoisted, Copies);
+
+      for (Instruction *Copy : Copies) {
+        Hoisted->andIRFlags(Copy);
+        toRemove.insert(Copy);
+        replacements[Copy] = Hoisted;
+        ++NumGVNRedundant;
+      }
+      ++NumGVNHoisted;
+      Changed = true;
+    }
+  }
+
+  return Changed;
+}
+
+// After hoisting, PHIs that merged the sibling copies may now receive one
+// value on every edge. Replace those whose common value dominates them.
+static bool
+removeRedundantPHIs(Function &F, DominatorTree &DT,
+                    SmallPtrSetImpl<Instruction *> &toRemove,
+                    DenseMap<Instruction *, Value *> &replacements,
+                    bool Verbose) {
+  bool Changed = false;
+
+  for (BasicBlock &BB : F) {
+    if (!DT.isReachableFromEntry(&BB))
+      continue;
+    for (PHINode &PN : BB.phis()) {
+      if (toRemove.count(&PN) || PN.getNumIncomingValues() == 0)
+        continue;
+
+      Value *Common = nullptr;
+      bool AllSame = true;
+      for (unsigned i = 0; i < PN.getNumIncomingValues(); ++i) {
+        if (!DT.isReachableFromEntry(PN.getIncomingBlock(i)))
+          continue;
+        Value *InVal =
+            getFinalReplacement(PN.getIncomingValue(i), replacements);
+        if (InVal == &PN)
+          continue;
+        if (Common && InVal != Common) {
+          AllSame = false;
+          break;
+        }
+        Common = InVal;
+      }
+      if (!AllSame || !Common)
+        continue;
+      if (Instruction *CommonInst = dyn_cast<Instruction>(Common))
+        if (!DT.dominates(CommonInst, &PN))
+          continue;
+
+      if (Verbose)
+        llvm::outs() << "PHI node merges a hoisted value: " << PN
+                     << "\n  Can be replaced with: " << *Common << "\n";
+      toRemove.insert(&PN);
+      replacements[&PN] = Common;
+      ++NumGVNRedundant;
+      Changed = true;
+    }
+  }
+
+  return Changed;
+}
+
+//------------------------------------------------------------------------------
+// Sinking into merge blocks
+//------------------------------------------------------------------------------
+// Find a PHI in the merge block that already receives Values[i] from Preds[i]
+static PHINode *findMatchingPHI(BasicBlock *Merge, ArrayRef<BasicBlock *> Preds,
+                                ArrayRef<Value *> Values) {
+  for (PHINode &PN : Merge->phis()) {
+    if (PN.getType() != Values[0]->getType())
+      continue;
+    bool Matches = true;
+    for (unsigned i = 0; i < Preds.size() && Matches; ++i)
+      Matches = PN.getIncomingValueForBlock(Preds[i]) == Values[i];
+    if (Matches)
+      return &PN;
+  }
+  return nullptr;
+}
+
+// If every incoming value of PN is the same operation, computed in its
+// incoming block and used only by PN, replace the copies by a single
+// instruction in the merge block. The copies may differ in at most one
+// operand, which is then merged by a PHI (reusing an existing PHI when one
+// already merges the same values), so the merge block grows by at most one
+// PHI for every N - 1 instructions removed.
+static bool sinkPHIIncomingValues(PHINode &PN, bool Verbose) {
+  BasicBlock *Merge = PN.getParent();
+  SmallVector<BasicBlock *, 8> Preds;
+  SmallVector<Instruction *, 8> Copies;
+
+  for (unsigned i = 0; i < PN.getNumIncomingValues(); ++i) {
+    Instruction *I = dyn_cast<Instruction>(PN.getIncomingValue(i));
+    if (!I || I->getParent() != PN.getIncomingBlock(i) || !I->hasOneUse())
+      return false;
+    if (!I->isBinaryOp() && !isa<CmpInst>(I) && !isa<CastInst>(I))
+      return false;
+    if (!Copies.empty() && !I->isSameOperationAs(Copies[0]))
+      return false;
+    Preds.push_back(PN.getIncomingBlock(i));
+    Copies.push_back(I);
+  }
+
+  Instruction *Sunk = Copies[0];
+  SmallVector<unsigned, 2> Differing;
+  for (unsigned Op = 0; Op < Sunk->getNumOperands(); ++Op)
+    if (any_of(Copies, [&](Instruction *I) {
+          return I->getOperand(Op) != Sunk->getOperand(Op);
+        }))
+      Differing.push_back(Op);
+  if (Differing.size() > 1)
+    return false;
+
+  if (Verbose)
+    llvm::outs() << "Sinking expression into merge block: " << *Sunk
+                 << "\n  To block: " << Merge->getName() << "\n";
+
+  Value *MergedOp = nullptr;
+  if (!Differing.empty()) {
+    SmallVector<Value *, 8> OpValues;
+    for (Instruction *I : Copies)
+      OpValues.push_back(I->getOperand(Differing[0]));
+    MergedOp = findMatchingPHI(Merge, Preds, OpValues);
+    if (!MergedOp) {
+      PHINode *NewPN =
+          PHINode::Create(OpValues[0]->getType(), Preds.size(),
+                          Sunk->getName() + ".sink", &Merge->front());
+      for (unsigned i = 0; i < Preds.size(); ++i)
+        NewPN->addIncoming(OpValues[i], Preds[i]);
+      MergedOp = NewPN;
+    }
+  }
+
+  // Debug users of the copies stay in the predecessors, where the sunk
+  // instruction is not available; describe them by the copies' operands
+  if (Sunk->isUsedByMetadata())
+    salvageDebugInfo(*Sunk);
+  Sunk->moveBefore(&*Merge->getFirstInsertionPt());
+  if (MergedOp)
+    Sunk->setOperand(Differing[0], MergedOp);
+  for (Instruction *I : drop_begin(Copies))
+    Sunk->andIRFlags(I);
+  mergeDebugLocations(Sunk, makeArrayRef(Copies).drop_front());
+
+  PN.replaceAllUsesWith(Sunk);
+  PN.eraseFromParent();
+  for (Instruction *I : drop_begin(Copies)) {
+    salvageDebugInfoAndErase(I);
+    ++NumGVNRedundant;
+  }
+  ++NumGVNSunk;
+  return true;
+}
+
+// Sink computations duplicated in all predecessors of merge blocks. Only
+// merge blocks whose predecessors all branch there unconditionally are
+// considered. Sinking repeats until no PHI changes, so a chain of
+// operations shared by the predecessors is sunk step by step.
+static bool sinkToCommonSuccessors(Function &F, DominatorTree &DT,
+                                   bool Verbose) {
+  bool Changed = false;
+
+  for (BasicBlock &Merge : F) {
+    if (!DT.isReachableFromEntry(&Merge) || !Merge.hasNPredecessorsOrMore(2))
+      continue;
+    if (any_of(predecessors(&Merge), [&](BasicBlock *Pred) {
+          BranchInst *BI = dyn_cast<BranchInst>(Pred->getTerminator());
+          return Pred == &Merge || !BI || BI->isConditional() ||
+                 !DT.isReachableFromEntry(Pred);
+        }))
+      continue;
+
+    bool Progress = true;
+    while (Progress) {
+      Progress = false;
+      for (PHINode &PN : Merge.phis()) {
+        if (sinkPHIIncomingValues(PN, Verbose)) {
+          Progress = Changed = true;
+          break;
+        }
+      }
+    }
+  }
+
+  return Changed;
+}
+
+//------------------------------------------------------------------------------
+// Parallel numbering
+//------------------------------------------------------------------------------
+namespace {
+// Alias analysis private to a parallel task. BasicAA keeps the state of a
+// query in the result object, so the function's AA results cannot be used
+// by several threads; each task queries its own BasicAA, TBAA and scoped
+// noalias results instead.
+struct TaskAliasAnalysis {
+  BasicAAResult BasicAA;
+  TypeBasedAAResult TBAA;
+  ScopedNoAliasAAResult ScopedNoAliasAA;
+  AAResults AA;
+  BatchAAResults BatchAA;
+
+  TaskAliasAnalysis(Function &F, const TargetLibraryInfo &TLI,
+                    AssumptionCache &AC, DominatorTree &DT)
+      : BasicAA(F.getParent()->getDataLayout(), F, TLI, AC, &DT), AA(TLI),
+        BatchAA(AA) {
+    AA.addAAResult(BasicAA);
+    AA.addAAResult(TBAA);
+    AA.addAAResult(ScopedNoAliasAA);
+  }
+};
+} // anonymous namespace
+
+// Whether the main walk would number I
+static bool isNumberedByWalk(Instruction &I) {
+  return !I.isTerminator() && !I.mayHaveSideEffects() && !I.isEHPad();
+}
+
+// Number the instructions of a large function on several threads before the
+// main walk, which then finds their numbers in the table. The blocks down to
+// the first dominator tree node with several children are numbered first;
+// the subtrees of its children are then independent and are numbered by
+// parallel tasks. A task only reads the table numbered before the split, so
+// it can run without locks except on the shared expression table, and its
+// results are merged once all tasks are done. Instructions that depend on a
+// PHI are left to the walk, since a PHI may see the values of any subtree.
+static void numberSubtreesInParallel(Function &F, DominatorTree &DT,
+                                     ValueTable &VT,
+                                     FunctionAnalysisManager &FAM) {
+  DomTreeNode *Split = DT.getRootNode();
+  SmallVector<BasicBlock *, 16> Prefix;
+  while (true) {
+    Prefix.push_back(Split->getBlock());
+    if (Split->getNumChildren() != 1)
+      break;
+    Split = *Split->begin();
+  }
+  if (Split->getNumChildren() < 2)
+    return;
+
+  for (BasicBlock *BB : Prefix)
+    for (Instruction &I : *BB)
+      if (isNumberedByWalk(I))
+        VT.lookupOrAddValue(&I);
+
+  // Larger subtrees are handed out first to balance the threads
+  SmallVector<std::pair<unsigned, DomTreeNode *>, 8> Subtrees;
+  for (DomTreeNode *Child : Split->children()) {
+    unsigned Size = 0;
+    for (DomTreeNode *Node : depth_first(Child))
+      Size += Node->getBlock()->size();
+    Subtrees.push_back({Size, Child});
+  }
+  llvm::sort(Subtrees, [](const auto &A, const auto &B) {
+    return A.first > B.first;
+  });
+
+  // Analyses used by the tasks are computed up front: the assumption cache
+  // scans the function on first use
+  const TargetLibraryInfo &TLI = FAM.getResult<TargetLibraryAnalysis>(F);
+  AssumptionCache &AC = FAM.getResult<AssumptionAnalysis>(F);
+  (void)AC.assumptions();
+
+  // The shared table does not grow. Every key is either the expression of an
+  // instruction or a value used as an operand, which bounds their number.
+  size_t MaxKeys = 0;
+  for (Instruction &I : instructions(F))
+    MaxKeys += 1 + I.getNumOperands();
+  ConcurrentExpressionTable Shared(VT.nextValueNumber, MaxKeys);
+  std::vector<ValueTable> Tasks(Subtrees.size());
+  std::atomic<unsigned> NextTask(0);
+  auto Worker = [&]() {
+    for (unsigned Idx = NextTask++; Idx < Subtrees.size(); Idx = NextTask++) {
+      ValueTable &Task = Tasks[Idx];
+      Task.Parent = &VT;
+      Task.Shared = &Shared;
+      Task.DT = &DT;
+      Task.NumberLoads = VT.NumberLoads;
+      Optional<TaskAliasAnalysis> TaskAA;
+      if (VT.BatchAA) {
+        TaskAA.emplace(F, TLI, AC, DT);
+        Task.BatchAA = &TaskAA->BatchAA;
+      }
+
+      for (DomTreeNode *Node : depth_first(Subtrees[Idx].second))
+        for (Instruction &I : *Node->getBlock()) {
+          if (!isNumberedByWalk(I))
+            continue;
+          Task.Deferred = false;
+          Task.lookupOrAddValue(&I);
+        }
+      Task.BatchAA = nullptr;
+      ++NumGVNParallelTasks;
+    }
+  };
+
+  unsigned NumThreads = ParallelThreads;
+  if (!NumThreads)
+    NumThreads = std::max(1u, std::thread::hardware_concurrency());
+  NumThreads = std::min<unsigned>(NumThreads, Subtrees.size());
+  std::vector<std::thread> Threads;
+  for (unsigned i = 1; i < NumThreads; ++i)
+    Threads.emplace_back(Worker);
+  Worker();
+  for (std::thread &T : Threads)
+    T.join();
+
+  for (ValueTable &Task : Tasks)
+    VT.mergeTask(Task);
+  VT.nextValueNumber = Shared.getNextNumber();
+}
+
+//------------------------------------------------------------------------------
+// Numbering engines
+//------------------------------------------------------------------------------
+// Optional engines run before the dominator tree walk (see GVNEngine). They
+// assign every instruction a symbolic value: a constant, the first member
+// met of its congruence class, or null while it is undetermined. Engines
+// differ in how they reach a fixpoint; the symbolic evaluation of an
+// instruction is shared.
+namespace {
+// Expressions computed so far, with the instruction representing each
+using ExpressionTable = std::unordered_map<std::string, Instruction *>;
+
+class ValueNumberingEngine {
+public:
+  virtual ~ValueNumberingEngine() = default;
+
+  // Compute the values. Returns false if the engine gave up, in which case
+  // none of the optimistic facts found so far may be used.
+  virtual bool solve() = 0;
+
+  // Whether BB may execute, as far as the engine knows
+  virtual bool isReachable(BasicBlock *BB) const = 0;
+
+  // The constant or congruent value V is known to be equal to, V itself if
+  // nothing better is known, or null while V is undetermined
+  Value *getValue(Value *V) const {
+    if (auto *I = dyn_cast<Instruction>(V))
+      return Values.lookup(I);
+    return V;
+  }
+
+protected:
+  explicit ValueNumberingEngine(const DataLayout &DL) : DL(DL) {}
+
+  // Whether values flow along the edge From->To, as far as the engine knows
+  virtual bool isExecutable(BasicBlock *From, BasicBlock *To) const = 0;
+
+  // Whether the value of I is derived from its operands; any other
+  // instruction is a class of its own
+  static bool isEvaluated(Instruction *I) {
+    return (I->isBinaryOp() || isa<CmpInst>(I) || isa<CastInst>(I) ||
+            isa<SelectInst>(I) || isa<GetElementPtrInst>(I) ||
+            isa<PHINode>(I)) &&
+           !I->mayHaveSideEffects();
+  }
+
+  Value *evaluate(Instruction *I, ExpressionTable &Expressions);
+  Value *evaluatePHI(PHINode *PN, ExpressionTable &Expressions);
+
+  const DataLayout &DL;
+  DenseMap<Instruction *, Value *> Values;
+};
+} // anonymous namespace
+
+// A PHI is the one value flowing in on its executable edges, ignoring those
+// still undetermined
+Value *ValueNumberingEngine::evaluatePHI(PHINode *PN,
+                                         ExpressionTable &Expressions) {
+  BasicBlock *BB = PN->getParent();
+  Value *Common = nullptr;
+  bool Undetermined = false, Varying = false;
+  std::string Expression;
+  raw_string_ostream OS(Expression);
+  OS << "phi " << BB;
+  for (unsigned Idx = 0; Idx < PN->getNumIncomingValues(); ++Idx) {
+    BasicBlock *Pred = PN->getIncomingBlock(Idx);
+    if (!isExecutable(Pred, BB))
+      continue;
+    Value *V = getValue(PN->getIncomingValue(Idx));
+    OS << " " << Pred << ":" << V;
+    if (V == PN)
+      continue;
+    if (!V)
+      Undetermined = true;
+    else if (!Common)
+      Common = V;
+    else if (V != Common)
+      Varying = true;
+  }
+  if (!Varying)
+    return Common;
+  if (Undetermined)
+    return PN;
+
+  // PHIs of a block merging the same values on every edge are congruent
+  OS.flush();
+  return Expressions.emplace(Expression, PN).first->second;
+}
+
+Value *ValueNumberingEngine::evaluate(Instruction *I,
+                                      ExpressionTable &Expressions) {
+  if (!isEvaluated(I))
+    return I;
+  if (auto *PN = dyn_cast<PHINode>(I))
+    return evaluatePHI(PN, Expressions);
+
+  SmallVector<Value *, 4> Ops;
+  bool AllConstant = true;
+  for (Value *Op : I->operands()) {
+    Value *V = getValue(Op);
+    if (!V)
+      return nullptr;
+    Ops.push_back(V);
+    AllConstant &= isa<Constant>(V);
+  }
+
+  // Constant folding, including the facts known from congruences
+  if (isa<SelectInst>(I)) {
+    if (auto *C = dyn_cast<ConstantInt>(Ops[0]))
+      return C->isZero() ? Ops[2] : Ops[1];
+    if (Ops[1] == Ops[2])
+      return Ops[1];
+  }
+  if (AllConstant) {
+    SmallVector<Constant *, 4> ConstOps;
+    for (Value *V : Ops)
+      ConstOps.push_back(cast<Constant>(V));
+    Constant *Folded =
+        isa<CmpInst>(I)
+            ? ConstantFoldCompareInstOperands(cast<CmpInst>(I)->getPredicate(),
+                                              ConstOps[0], ConstOps[1], DL)
+            : ConstantFoldInstOperands(I, ConstOps, DL);
+    if (Folded)
+      return Folded;
+  }
+  auto *Cmp = dyn_cast<CmpInst>(I);
+  if (Cmp && isa<ICmpInst>(Cmp) && Ops[0] == Ops[1])
+    return ConstantInt::getBool(I->getType(),
+                                CmpInst::isTrueWhenEqual(Cmp->getPredicate()));
+
+  // Otherwise the instruction is congruent to those computing the same
+  // operation on the same values. Commutative operands and compares are put
+  // in a canonical order first.
+  unsigned Predicate = Cmp ? unsigned(Cmp->getPredicate()) : 0u;
+  if (Ops.size() == 2 && std::less<Value *>()(Ops[1], Ops[0]) &&
+      (I->isCommutative() || Cmp)) {
+    std::swap(Ops[0], Ops[1]);
+    if (Cmp)
+      Predicate = CmpInst::getSwappedPredicate(Cmp->getPredicate());
+  }
+  std::string Expression;
+  raw_string_ostream OS(Expression);
+  OS << I->getOpcode() << " " << I->getType() << " " << Predicate;
+  if (auto *GEP = dyn_cast<GetElementPtrInst>(I))
+    OS << " " << GEP->getSourceElementType() << " " << GEP->isInBounds();
+  for (Value *V : Ops)
+    OS << " " << V;
+  OS.flush();
+  return Expressions.emplace(Expression, I).first->second;
+}
+
+//
+// Sparse conditional numbering (engine=sccp)
+//
+// Solves constants, reachability and congruences together, after Click's
+// combined analysis. Blocks start out unreachable and values undetermined,
+// and are only revised towards reachable and varying, so each analysis feeds
+// the other: a compare of two congruent values is a constant, a branch on a
+// constant leaves a successor dead, and a PHI ignores the values flowing in
+// on dead edges, which makes more PHIs constant or congruent. Neither SCCP
+// nor GVN on its own finds all of these.
+namespace {
+class SparseConditionalNumbering : public ValueNumberingEngine {
+public:
+  SparseConditionalNumbering(Function &F, const DataLayout &DL)
+      : ValueNumberingEngine(DL), RPOT(&F) {}
+
+  // Sweep the function in reverse post-order until nothing changes, giving
+  // up after -demo-gvn-sccp-max-sweeps sweeps
+  bool solve() override;
+
+  bool isReachable(BasicBlock *BB) const override {
+    return Reachable.count(BB);
+  }
+
+protected:
+  bool isExecutable(BasicBlock *From, BasicBlock *To) const override {
+    return ExecutableEdges.count({From, To});
+  }
+
+private:
+  void markSuccessors(Instruction *Term);
+  void markEdge(BasicBlock *From, BasicBlock *To);
+
+  ReversePostOrderTraversal<Function *> RPOT;
+  SmallPtrSet<BasicBlock *, 32> Reachable;
+  DenseSet<std::pair<BasicBlock *, BasicBlock *>> ExecutableEdges;
+  bool Changed = false;
+};
+} // anonymous namespace
+
+bool SparseConditionalNumbering::solve() {
+  Reachable.insert(*RPOT.begin());
+  ExpressionTable Expressions;
+  for (unsigned Sweep = 0; Sweep < SCCPMaxSweeps; ++Sweep) {
+    // Congruence classes are formed anew in every sweep, from the values
+    // of the operands, which only become more precise
+    Changed = false;
+    Expressions.clear();
+    for (BasicBlock *BB : RPOT) {
+      if (!Reachable.count(BB))
+        continue;
+      for (Instruction &I : *BB) {
+        if (I.isTerminator()) {
+          markSuccessors(&I);
+          continue;
+        }
+        Value *V = evaluate(&I, Expressions);
+        Value *&Slot = Values[&I];
+        if (Slot != V) {
+          Slot = V;
+          Changed = true;
+        }
+      }
+    }
+    if (!Changed)
+      return true;
+  }
+  return false;
+}
+
+void SparseConditionalNumbering::markEdge(BasicBlock *From, BasicBlock *To) {
+  if (ExecutableEdges.insert({From, To}).second) {
+    Reachable.insert(To);
+    Changed = true;
+  }
+}
+
+// Mark the edges that can be taken for the current value of the condition
+void SparseConditionalNumbering::markSuccessors(Instruction *Term) {
+  BasicBlock *BB = Term->getParent();
+  if (auto *BI = dyn_cast<BranchInst>(Term)) {
+    if (BI->isConditional()) {
+      Value *Cond = getValue(BI->getCondition());
+      if (!Cond)
+        return;
+      if (auto *C = dyn_cast<ConstantInt>(Cond)) {
+        markEdge(BB, BI->getSuccessor(C->isZero() ? 1 : 0));
+        return;
+      }
+    }
+  } else if (auto *SI = dyn_cast<SwitchInst>(Term)) {
+    Value *Cond = getValue(SI->getCondition());
+    if (!Cond)
+      return;
+    if (auto *C = dyn_cast<ConstantInt>(Cond)) {
+      markEdge(BB, SI->findCaseValue(C)->getCaseSuccessor());
+      return;
+    }
+  }
+  for (BasicBlock *Succ : successors(BB))
+    markEdge(BB, Succ);
+}
+
+//
+// SCC value numbering (engine=sccvn)
+//
+// Simpson's SCC-based value numbering. The strongly connected components of
+// the SSA graph (instructions and the operands they are evaluated from) are
+// visited operands first. An acyclic component is numbered once, directly
+// in the valid table. Only the members of a cycle, i.e. PHIs in loops and
+// what they feed back into, are iterated optimistically in a table of their
+// own until their values stop changing, and are then numbered once more in
+// the valid table. Every block reachable in the CFG is taken to execute.
+namespace {
+class SCCValueNumbering : public ValueNumberingEngine {
+public:
+  SCCValueNumbering(Function &F, const DataLayout &DL,
+                    const DominatorTree &DT)
+      : ValueNumberingEngine(DL), F(F), DT(DT) {}
+
+  // Cycles that do not settle within -demo-gvn-sccvn-max-iterations keep
+  // every member in a class of its own, so this engine never gives up
+  bool solve() override;
+
+  bool isReachable(BasicBlock *BB) const override {
+    return DT.isReachableFromEntry(BB);
+  }
+
+protected:
+  bool isExecutable(BasicBlock *From, BasicBlock *) const override {
+    return DT.isReachableFromEntry(From);
+  }
+
+private:
+  void findSCCs();
+  void numberCycle(ArrayRef<Instruction *> SCC);
+
+  Function &F;
+  const DominatorTree &DT;
+  // Position of each evaluated instruction in reverse post-order
+  DenseMap<Instruction *, unsigned> Order;
+  // Components of the SSA graph, operands before users
+  std::vector<SmallVector<Instruction *, 1>> SCCs;
+  ExpressionTable Valid, Optimistic;
+};
+} // anonymous namespace
+
+// Tarjan's algorithm over the evaluated instructions, starting from each in
+// reverse post-order, so that the components come out in a stable order
+void SCCValueNumbering::findSCCs() {
+  SmallVector<Instruction *, 32> Roots;
+  ReversePostOrderTraversal<Function *> RPOT(&F);
+  for (BasicBlock *BB : RPOT)
+    for (Instruction &I : *BB)
+      if (isEvaluated(&I)) {
+        Order[&I] = Roots.size();
+        Roots.push_back(&I);
+      }
+
+  DenseMap<Instruction *, unsigned> Index, LowLink;
+  SmallVector<Instruction *, 32> Stack;
+  SmallPtrSet<Instruction *, 32> OnStack;
+  SmallVector<std::pair<Instruction *, unsigned>, 32> DFS;
+  unsigned NextIndex = 0;
+  auto Visit = [&](Instruction *I) {
+    Index[I] = LowLink[I] = NextIndex++;
+    Stack.push_back(I);
+    OnStack.insert(I);
+    DFS.push_back({I, 0});
+  };
+
+  for (Instruction *Root : Roots) {
+    if (Index.count(Root))
+      continue;
+    Visit(Root);
+    while (!DFS.empty()) {
+      Instruction *I = DFS.back().first;
+      unsigned OpIdx = DFS.back().second++;
+      if (OpIdx < I->getNumOperands()) {
+        auto *Op = dyn_cast<Instruction>(I->getOperand(OpIdx));
+        if (!Op || !Order.count(Op))
+          continue;
+        if (!Index.count(Op))
+          Visit(Op);
+        else if (OnStack.count(Op))
+          LowLink[I] = std::min(LowLink[I], Index[Op]);
+        continue;
+      }
+
+      DFS.pop_back();
+      if (!DFS.empty()) {
+        Instruction *Parent = DFS.back().first;
+        LowLink[Parent] = std::min(LowLink[Parent], LowLink[I]);
+      }
+      if (LowLink[I] != Index[I])
+        continue;
+      SCCs.emplace_back();
+      Instruction *Member;
+      do {
+        Member = Stack.pop_back_val();
+        OnStack.erase(Member);
+        SCCs.back().push_back(Member);
+      } while (Member != I);
+    }
+  }
+}
+
+// Iterate the members of a cycle, in reverse post-order, from undetermined
+// values until they settle, then number them in the valid table
+void SCCValueNumbering::numberCycle(ArrayRef<Instruction *> SCC) {
+  for (unsigned Iteration = 0; Iteration < SCCVNMaxIterations; ++Iteration) {
+    Optimistic.clear();
+    bool Changed = false;
+    for (Instruction *I : SCC) {
+      Value *V = evaluate(I, Optimistic);
+      Value *&Slot = Values[I];
+      if (Slot != V) {
+        Slot = V;
+        Changed = true;
+      }
+    }
+    if (!Changed) {
+      for (Instruction *I : SCC)
+        Values[I] = evaluate(I, Valid);
+      return;
+    }
+  }
+  for (Instruction *I : SCC)
+    Values[I] = I;
+}
+
+bool SCCValueNumbering::solve() {
+  findSCCs();
+  for (BasicBlock &BB : F)
+    if (DT.isReachableFromEntry(&BB))
+      for (Instruction &I : BB)
+        if (!Order.count(&I))
+          Values[&I] = &I;
+
+  for (SmallVector<Instruction *, 1> &SCC : SCCs) {
+    Instruction *I = SCC.front();
+    bool Cyclic = SCC.size() > 1 || is_contained(I->operands(), I);
+    if (!Cyclic) {
+      Values[I] = evaluate(I, Valid);
+      continue;
+    }
+    llvm::sort(SCC, [&](Instruction *A, Instruction *B) {
+      return Order.lookup(A) < Order.lookup(B);
+    });
+    numberCycle(SCC);
+  }
+  return true;
+}
+
+//
+// Partition refinement (engine=partition)
+//
+// Alpern, Wegman and Zadeck's coarsest congruence, computed with Hopcroft's
+// partition refinement in O(E log V). Instructions start out in one class
+// per operation (opcode, type, predicate, block of a PHI, ...) and values
+// not derived from their operands in a class of their own. A class is split
+// whenever its members' i-th operands lie in different classes, until no
+// split is left. Being optimistic about every cycle at once, this finds all
+// congruences between cycles, including independent induction variables,
+// without iterating, but it folds no constants and finds no dead branches.
+namespace {
+class PartitionRefinementNumbering : public ValueNumberingEngine {
+public:
+  PartitionRefinementNumbering(Function &F, const DataLayout &DL,
+                               const DominatorTree &DT)
+      : ValueNumberingEngine(DL), F(F), DT(DT) {}
+
+  bool solve() override;
+
+  bool isReachable(BasicBlock *BB) const override {
+    return DT.isReachableFromEntry(BB);
+  }
+
+protected:
+  bool isExecutable(BasicBlock *From, BasicBlock *) const override {
+    return DT.isReachableFromEntry(From);
+  }
+
+private:
+  // A value with the values its own is derived from, in a canonical order
+  struct Node {
+    Value *V;
+    SmallVector<unsigned, 2> Ops;
+  };
+
+  unsigned getNode(Value *V);
+  void buildGraph();
+  std::string getLabel(const Node &N) const;
+  void split(unsigned Class, ArrayRef<unsigned> Members);
+
+  Function &F;
+  const DominatorTree &DT;
+  std::vector<Node> Nodes;
+  DenseMap<Value *, unsigned> NodeOf;
+  // Rank of the operands of commutative operations, see buildGraph
+  DenseMap<Value *, unsigned> Rank;
+  // Nodes using each node, with the operand position of the use
+  std::vector<SmallVector<std::pair<unsigned, unsigned>, 2>> Users;
+  std::vector<std::vector<unsigned>> Classes;
+  std::vector<unsigned> ClassOf, PosInClass;
+  unsigned MaxArity = 0;
+  // Pending splitters: a class, and the operand position it splits by
+  SmallVector<std::pair<unsigned, unsigned>, 32> Worklist;
+  DenseSet<std::pair<unsigned, unsigned>> InWorklist;
+};
+} // anonymous namespace
+
+unsigned PartitionRefinementNumbering::getNode(Value *V) {
+  auto Inserted = NodeOf.try_emplace(V, Nodes.size());
+  if (Inserted.second) {
+    Nodes.push_back({V, {}});
+    Users.emplace_back();
+  }
+  return Inserted.first->second;
+}
+
+// Create a node for every evaluated instruction of a reachable block, in
+// reverse post-order, then link each to its operands. The operands of a
+// commutative operation or a compare are ordered by rank (arguments, then
+// instructions in reverse post-order, constants last), so that a + b and
+// b + a get the same operand list. Those of a PHI are ordered like the
+// incoming blocks of the first PHI of its block, leaving out unreachable
+// predecessors.
+void PartitionRefinementNumbering::buildGraph() {
+  for (Argument &A : F.args())
+    Rank[&A] = Rank.size();
+  SmallVector<Instruction *, 32> Evaluated;
+  ReversePostOrderTraversal<Function *> RPOT(&F);
+  for (BasicBlock *BB : RPOT)
+    for (Instruction &I : *BB) {
+      Rank[&I] = Rank.size();
+      if (isEvaluated(&I)) {
+        getNode(&I);
+        Evaluated.push_back(&I);
+      } else {
+        Values[&I] = &I;
+      }
+    }
+
+  auto GetRank = [&](Value *V) {
+    return isa<Constant>(V) ? ~0u : Rank.lookup(V);
+  };
+  for (Instruction *I : Evaluated) {
+    SmallVector<Value *, 4> Ops;
+    if (auto *PN = dyn_cast<PHINode>(I)) {
+      PHINode *First = &*PN->getParent()->phis().begin();
+      for (BasicBlock *Pred : First->blocks())
+        if (isExecutable(Pred, PN->getParent()))
+          Ops.push_back(PN->getIncomingValueForBlock(Pred));
+    } else {
+      Ops.append(I->op_begin(), I->op_end());
+      if (Ops.size() == 2 && (I->isCommutative() || isa<CmpInst>(I)) &&
+          GetRank(Ops[1]) < GetRank(Ops[0]))
+        std::swap(Ops[0], Ops[1]);
+    }
+
+    unsigned Id = NodeOf.lookup(I);
+    for (Value *Op : Ops) {
+      unsigned OpId = getNode(Op);
+      Users[OpId].push_back({Id, unsigned(Nodes[Id].Ops.size())});
+      Nodes[Id].Ops.push_back(OpId);
+    }
+    MaxArity = std::max<unsigned>(MaxArity, Ops.size());
+  }
+}
+
+// Operation of a node; nodes with different labels are never congruent
+std::string PartitionRefinementNumbering::getLabel(const Node &N) const {
+  std::string Label;
+  raw_string_ostream OS(Label);
+  auto *I = dyn_cast<Instruction>(N.V);
+  if (!I || !isEvaluated(I)) {
+    OS << "leaf " << N.V;
+    return OS.str();
+  }
+  OS << I->getOpcode() << " " << I->getType() << " " << N.Ops.size();
+  if (auto *Cmp = dyn_cast<CmpInst>(I)) {
+    bool Swapped = Nodes[N.Ops[0]].V != Cmp->getOperand(0);
+    OS << " " << (Swapped ? Cmp->getSwappedPredicate() : Cmp->getPredicate());
+  }
+  if (auto *GEP = dyn_cast<GetElementPtrInst>(I))
+    OS << " " << GEP->getSourceElementType() << " " << GEP->isInBounds();
+  if (isa<PHINode>(I))
+    OS << " " << I->getParent();
+  return OS.str();
+}
+
+// Move Members, a proper subset of Class, to a class of their own, and
+// schedule the splitters the new class needs
+void PartitionRefinementNumbering::split(unsigned Class,
+                                         ArrayRef<unsigned> Members) {
+  unsigned New = Classes.size();
+  Classes.emplace_back();
+  for (unsigned N : Members) {
+    std::vector<unsigned> &Old = Classes[Class];
+    unsigned Last = Old.back();
+    Old[PosInClass[N]] = Last;
+    PosInClass[Last] = PosInClass[N];
+    Old.pop_back();
+    ClassOf[N] = New;
+    PosInClass[N] = Classes[New].size();
+    Classes[New].push_back(N);
+  }
+
+  // Hopcroft: where the old class is still pending, both halves are;
+  // otherwise splitting by the smaller half is enough
+  for (unsigned Pos = 0; Pos < MaxArity; ++Pos) {
+    unsigned Splitter = New;
+    if (!InWorklist.count({Class, Pos}) &&
+        Classes[Class].size() < Classes[New].size())
+      Splitter = Class;
+    if (InWorklist.insert({Splitter, Pos}).second)
+      Worklist.push_back({Splitter, Pos});
+  }
+}
+
+bool PartitionRefinementNumbering::solve() {
+  buildGraph();
+
+  // Initial partition by label
+  std::unordered_map<std::string, unsigned> ClassOfLabel;
+  ClassOf.resize(Nodes.size());
+  PosInClass.resize(Nodes.size());
+  for (unsigned N = 0; N < Nodes.size(); ++N) {
+    auto It = ClassOfLabel.emplace(getLabel(Nodes[N]), Classes.size()).first;
+    if (It->second == Classes.size())
+      Classes.emplace_back();
+    ClassOf[N] = It->second;
+    PosInClass[N] = Classes[It->second].size();
+    Classes[It->second].push_back(N);
+  }
+  for (unsigned C = 0; C < Classes.size(); ++C)
+    for (unsigned Pos = 0; Pos < MaxArity; ++Pos) {
+      Worklist.push_back({C, Pos});
+      InWorklist.insert({C, Pos});
+    }
+
+  // Split every class by the classes of its members' operands
+  while (!Worklist.empty()) {
+    std::pair<unsigned, unsigned> Splitter = Worklist.pop_back_val();
+    InWorklist.erase(Splitter);
+
+    MapVector<unsigned, SmallVector<unsigned, 4>> Hits;
+    for (unsigned M : Classes[Splitter.first])
+      for (const auto &Use : Users[M])
+        if (Use.second == Splitter.second)
+          Hits[ClassOf[Use.first]].push_back(Use.first);
+    for (auto &Hit : Hits)
+      if (Hit.second.size() < Classes[Hit.first].size())
+        split(Hit.first, Hit.second);
+  }
+
+  // The first node of a class in reverse post-order represents it
+  for (const std::vector<unsigned> &Class : Classes) {
+    unsigned Leader = *std::min_element(Class.begin(), Class.end());
+    for (unsigned N : Class)
+      if (auto *I = dyn_cast<Instruction>(Nodes[N].V))
+        Values[I] = Nodes[Leader].V;
+  }
+  return true;
+}
+
+//
+// Applying the results
+//
+// Run the engine selected and rewrite the function with its results: values
+// become their constant or a congruent value dominating them, and branches
+// on a constant go to their one live successor
+static bool runNumberingEngine(GVNEngine Kind, Function &F, DominatorTree &DT,
+                               bool Verbose) {
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  std::unique_ptr<ValueNumberingEngine> Engine;
+  switch (Kind) {
+  case GVNEngine::None:
+    return false;
+  case GVNEngine::SCCP:
+    Engine = std::make_unique<SparseConditionalNumbering>(F, DL);
+    break;
+  case GVNEngine::SCCVN:
+    Engine = std::make_unique<SCCValueNumbering>(F, DL, DT);
+    break;
+  case GVNEngine::Partition:
+    Engine = std::make_unique<PartitionRefinementNumbering>(F, DL, DT);
+    break;
+  }
+  if (!Engine->solve()) {
+    if (Verbose)
+      llvm::outs() << "Numbering engine did not converge, results dropped\n";
+    return false;
+  }
+
+  bool Changed = false;
+  SmallVector<Instruction *, 16> Replaced;
+  SmallVector<BasicBlock *, 8> Folded;
+  for (BasicBlock &BB : F) {
+    if (!Engine->isReachable(&BB))
+      continue;
+    for (Instruction &I : BB) {
+      if (I.isTerminator()) {
+        Value *Cond = nullptr;
+        if (auto *BI = dyn_cast<BranchInst>(&I))
+          Cond = BI->isConditional() ? BI->getCondition() : nullptr;
+        else if (auto *SI = dyn_cast<SwitchInst>(&I))
+          Cond = SI->getCondition();
+        if (Cond && isa_and_nonnull<ConstantInt>(Engine->getValue(Cond))) {
+          I.replaceUsesOfWith(Cond, Engine->getValue(Cond));
+          Folded.push_back(&BB);
+        }
+        continue;
+      }
+
+      Value *V = Engine->getValue(&I);
+      if (!V || V == &I)
+        continue;
+      if (auto *Leader = dyn_cast<Instruction>(V))
+        if (!DT.dominates(Leader, &I))
+          continue;
+      if (Verbose)
+        llvm::outs() << "Numbering engine: " << I
+                     << "\n  Can be replaced with: " << *V << "\n";
+      patchReplacementInstruction(&I, V);
+      I.replaceAllUsesWith(V);
+      Replaced.push_back(&I);
+      ++NumGVNEngineValues;
+      Changed = true;
+    }
+  }
+  for (Instruction *I : Replaced)
+    salvageDebugInfoAndErase(I);
+
+  DomTreeUpdater DTU(DT, DomTreeUpdater::UpdateStrategy::Eager);
+  for (BasicBlock *BB : Folded) {
+    if (Verbose)
+      llvm::outs() << "Folding branch: " << *BB->getTerminator() << "\n";
+    if (ConstantFoldTerminator(BB, /*DeleteDeadConditions=*/true, nullptr,
+                               &DTU)) {
+      ++NumGVNEngineBranches;
+      Changed = true;
+    }
+  }
+  return Changed;
+}
+
+//------------------------------------------------------------------------------
+// Function attributes
+//------------------------------------------------------------------------------
+// Cold functions, by attribute or by profile entry count, only get the quick
+// mode since their code matters little at runtime. Functions optimized for
+// size get no stage that inserts instructions.
+static GVNOptions getFunctionOptions(Function &F, FunctionAnalysisManager &FAM,
+                                     const GVNOptions &Options) {
+  bool Cold = F.hasFnAttribute(Attribute::Cold);
+  if (!Cold) {
+    const auto &MAMProxy =
+        FAM.getResult<ModuleAnalysisManagerFunctionProxy>(F);
+    ProfileSummaryInfo *PSI =
+        MAMProxy.getCachedResult<ProfileSummaryAnalysis>(*F.getParent());
+    Cold = PSI && PSI->hasProfileSummary() && PSI->isFunctionEntryCold(&F);
+  }
+
+  GVNOptions FnOptions = Options;
+  if (Cold) {
+    FnOptions = GVNOptions::getQuick(Options.Verbose);
+    ++NumGVNColdFunctions;
+  }
+  if (F.hasMinSize())
+    FnOptions.Sink = false;
+  return FnOptions;
+}
+
 PreservedAnalyses GVN::run(Function &F, FunctionAnalysisManager &FAM) {
-  llvm::outs() << "Running GVN on function: " << F.getName() << "\n";
+  // Pipelines skip optnone functions on their own, but the library entry
+  // point and the tools call the pass directly
+  if (F.hasOptNone())
+    return PreservedAnalyses::all();
+
+  const GVNOptions FnOptions = getFunctionOptions(F, FAM, Options);
+  const bool Verbose = FnOptions.Verbose;
+  if (Verbose)
+    llvm::outs() << "Running GVN on function: " << F.getName() << "\n";
   bool Changed = false;
 
   // Get dominator tree for the function
   DominatorTree &DT = FAM.getResult<DominatorTreeAnalysis>(F);
+  const DataLayout &DL = F.getParent()->getDataLayout();
+
+  // Optionally apply the results of a numbering engine first. Analyses of
+  // the old control flow, other than the dominator tree kept up to date, are
+  // dropped before the stages below request them.
+  if (runNumberingEngine(FnOptions.Engine, F, DT, Verbose)) {
+    PreservedAnalyses PA;
+    PA.preserve<DominatorTreeAnalysis>();
+    FAM.invalidate(F, PA);
+    Changed = true;
+  }
+
+  // Alias queries are batched per function so that repeated queries between
+  // the same locations are answered from the cache. They are only needed to
+  // number loads.
+  Optional<BatchAAResults> BatchAA;
+  if (FnOptions.NumberLoads)
+    BatchAA.emplace(FAM.getResult<AAManager>(F));
 
   // Our value table for this function
   ValueTable VT;
+  VT.BatchAA = BatchAA.hasValue() ? &*BatchAA : nullptr;
+  VT.NumberLoads = FnOptions.NumberLoads;
+  VT.DT = &DT;
 
   // Set to track instructions to remove
   SmallPtrSet<Instruction *, 32> toRemove;
@@ -287,9 +2325,16 @@ PreservedAnalyses GVN::run(Function &F, FunctionAnalysisManager &FAM) {
   // Map from instructions to their replacements
   DenseMap<Instruction *, Value *> replacements;
 
+  // Code below a switch case knows the value switched on
+  if (FnOptions.Conditions)
+    Changed |= propagateSwitchCases(F, DT, Verbose);
+
   // First pass: look for trivial PHI nodes where all incoming values are the same
-  // This helps identify cases where PHIs can be immediately replaced
+  // This helps identify cases where PHIs can be immediately replaced. Like
+  // every other stage, it only looks at blocks reachable from the entry.
   for (auto &BB : F) {
+    if (!DT.isReachableFromEntry(&BB))
+      continue;
     for (auto &I : BB) {
       if (PHINode *PN = dyn_cast<PHINode>(&I)) {
         // Skip PHIs with no incoming values
@@ -308,8 +2353,9 @@ PreservedAnalyses GVN::run(Function &F, FunctionAnalysisManager &FAM) {
         }
 
         if (AllSame) {
-          llvm::outs() << "Found trivial PHI node: " << *PN
-                      << "\n  All values are: " << *FirstVal << "\n";
+          if (Verbose)
+            llvm::outs() << "Found trivial PHI node: " << *PN
+                        << "\n  All values are: " << *FirstVal << "\n";
           toRemove.insert(PN);
           replacements[PN] = FirstVal;
           ++NumGVNRedundant;
@@ -319,10 +2365,63 @@ PreservedAnalyses GVN::run(Function &F, FunctionAnalysisManager &FAM) {
     }
   }
 
-  // Process blocks in dominator tree pre-order to ensure
-  // we process definitions before uses
-  for (auto *Node : post_order(DT.getRootNode())) {
-    BasicBlock *BB = Node->getBlock();
+  // Experimental: number large functions on several threads first
+  if (FnOptions.Parallel && F.getInstructionCount() >= ParallelMinSize)
+    numberSubtreesInParallel(F, DT, VT, FAM);
+
+  // Process blocks in dominator tree pre-order to ensure we process
+  // definitions before uses. Leaders are scoped to the dominator subtree of
+  // the block defining them, so a leader always dominates what it replaces.
+  // Compares implied by the branch conditions dominating them are folded to
+  // constants, and so are the conditional branches using them.
+  LeaderTable Leaders;
+  SmallVector<DominatingCondition, 16> Conditions;
+  SmallVector<std::pair<BranchInst *, bool>, 8> DecidedBranches;
+  SmallSetVector<BranchInst *, 8> ImpliedBranches;
+  // Address computations of forwarded loads that turned out redundant,
+  // deleted with them at the end
+  SmallVector<Value *, 4> DeadForwardPointers;
+  SmallVector<std::unique_ptr<DomScope>, 16> WorkStack;
+  WorkStack.push_back(std::make_unique<DomScope>(Leaders, DT.getRootNode()));
+
+  while (!WorkStack.empty()) {
+    DomScope &Top = *WorkStack.back();
+    if (Top.Visited) {
+      if (Top.NextChild == Top.Node->end())
+        WorkStack.pop_back();
+      else
+        WorkStack.push_back(std::make_unique<DomScope>(
+            Leaders, *Top.NextChild++, Top.NumConditions));
+      continue;
+    }
+    Top.Visited = true;
+    BasicBlock *BB = Top.Node->getBlock();
+    if (FnOptions.Conditions) {
+      Conditions.resize(Top.ParentConditions);
+      if (DomTreeNode *IDom = Top.Node->getIDom()) {
+        BasicBlock *Pred = IDom->getBlock();
+        addEdgeConditions(Pred, BB, DT, Conditions);
+
+        // Values congruent to the switch value are the case value as well
+        if (auto *SI = dyn_cast<SwitchInst>(Pred->getTerminator()))
+          if (ConstantInt *CaseValue = getUniqueCaseValue(SI, BB, DT))
+            Leaders.insert(VT.lookupOrAddValue(SI->getCondition()), CaseValue);
+      }
+      Top.NumConditions = Conditions.size();
+
+      auto *BI = dyn_cast<BranchInst>(BB->getTerminator());
+      if (BI && BI->isConditional() && !isa<Constant>(BI->getCondition()))
+        if (Optional<bool> Implied =
+                getImpliedCondition(BI->getCondition(), Conditions, DL)) {
+          if (Verbose)
+            llvm::outs() << "Found branch decided by a dominating condition: "
+                         << *BI << "\n  Condition is always "
+                         << (*Implied ? "true" : "false") << "\n";
+          DecidedBranches.push_back({BI, *Implied});
+          ++NumGVNImpliedConditions;
+          Changed = true;
+        }
+    }
 
     // Process each instruction in the block
     for (auto I = BB->begin(); I != BB->end(); ++I) {
@@ -335,31 +2434,31 @@ PreservedAnalyses GVN::run(Function &F, FunctionAnalysisManager &FAM) {
 
       // Special handling for PHI nodes
       if (PHINode *PN = dyn_cast<PHINode>(Inst)) {
-        llvm::outs() << "Processing PHI node: " << *PN << "\n";
-        // Check if all incoming values are the same
-        Value *CommonValue = nullptr;
-        bool AllSame = true;
+        if (Verbose)
+          llvm::outs() << "Processing PHI node: " << *PN << "\n";
 
         // Skip PHIs with no incoming values
         if (PN->getNumIncomingValues() == 0)
           continue;
 
-        // Get the first incoming value as reference
-        CommonValue = PN->getIncomingValue(0);
+        // Check if all incoming values are the same, using the precomputed
+        // signature
+        const PHISignature &Sig = VT.getPHISignature(PN);
+        Value *CommonValue = Sig.FirstValue;
+        bool AllSame = Sig.SingleValue;
 
-        // Check if all other incoming values are the same
-        for (unsigned i = 1; i < PN->getNumIncomingValues(); ++i) {
-          Value *InVal = PN->getIncomingValue(i);
-          if (InVal != CommonValue && !VT.areEqual(InVal, CommonValue)) {
-            AllSame = false;
-            break;
-          }
-        }
+        // The common value must be available wherever the PHI is used
+        if (AllSame)
+          if (Instruction *CommonInst = dyn_cast<Instruction>(CommonValue))
+            if (!DT.dominates(CommonInst, PN))
+              AllSame = false;
 
         // If all incoming values are the same, we can replace the PHI
         if (AllSame) {
-          llvm::outs() << "PHI node has all same values, can be replaced with: "
-                      << *CommonValue << "\n";
+          if (Verbose)
+            llvm::outs() << "PHI node has all same values, can be replaced "
+                            "with: "
+                         << *CommonValue << "\n";
           toRemove.insert(PN);
           replacements[PN] = CommonValue;
           ++NumGVNRedundant;
@@ -373,47 +2472,206 @@ PreservedAnalyses GVN::run(Function &F, FunctionAnalysisManager &FAM) {
       // Count instructions processed
       ++NumGVNInstructions;
 
+      // Loads clobbered by a memset or memcpy are answered from the intrinsic.
+      // At minsize only when the answer is a constant.
+      Value *Forwarded = nullptr;
+      if (LoadInst *LI = dyn_cast<LoadInst>(Inst))
+        if (LI->isSimple() && FnOptions.NumberLoads)
+          if (MemIntrinsic *MI =
+                  dyn_cast_or_null<MemIntrinsic>(VT.getMemoryState(LI)))
+            Forwarded =
+                forwardFromMemIntrinsic(LI, MI, VT, DL, !F.hasMinSize());
+
+      if (Forwarded) {
+        // A load rewritten to read the memcpy source may itself be redundant
+        if (LoadInst *NewLoad = dyn_cast<LoadInst>(Forwarded)) {
+          ValueNumber NewVN = VT.lookupOrAddValue(NewLoad);
+          if (Value *Available =
+                  lookupLeader(Leaders, NewVN, NewLoad->getType())) {
+            // Not freed until alias queries are over: the batched results
+            // are cached by address, which the next forwarded load could
+            // reuse
+            toRemove.insert(NewLoad);
+            replacements[NewLoad] = Available;
+            DeadForwardPointers.push_back(NewLoad->getPointerOperand());
+            Forwarded = Available;
+          } else {
+            Leaders.insert(NewVN, NewLoad);
+          }
+        }
+
+        if (Verbose)
+          llvm::outs() << "Forwarded load from memory intrinsic: " << *Inst
+                       << "\n  Can be replaced with: " << *Forwarded << "\n";
+        Leaders.insert(VT.lookupOrAddValue(Inst), Forwarded);
+        toRemove.insert(Inst);
+        replacements[Inst] = Forwarded;
+        ++NumGVNLoadsForwarded;
+        Changed = true;
+        continue;
+      }
+
+      // Operands made constant by a switch case, or by folding, fold the
+      // instruction itself
+      if (FnOptions.Conditions)
+        if (Constant *Folded = foldToConstant(Inst, replacements, DL)) {
+          if (Verbose)
+            llvm::outs() << "Found instruction with constant operands: "
+                         << *Inst << "\n  Can be replaced with: " << *Folded
+                         << "\n";
+          if (auto *Cmp = dyn_cast<CmpInst>(Inst))
+            for (User *U : Cmp->users())
+              if (auto *UserBI = dyn_cast<BranchInst>(U))
+                ImpliedBranches.insert(UserBI);
+          toRemove.insert(Inst);
+          replacements[Inst] = Folded;
+          ++NumGVNRedundant;
+          Changed = true;
+          continue;
+        }
+
+      // A compare decided by a dominating branch condition is a constant
+      if (auto *Cmp = dyn_cast<ICmpInst>(Inst))
+        if (FnOptions.Conditions)
+          if (Optional<bool> Implied =
+                  getImpliedCondition(Cmp, Conditions, DL)) {
+            Constant *Folded = ConstantInt::getBool(Cmp->getType(), *Implied);
+            if (Verbose)
+              llvm::outs() << "Found compare implied by a dominating "
+                              "condition: "
+                           << *Cmp << "\n  Can be replaced with: " << *Folded
+                           << "\n";
+            for (User *U : Cmp->users())
+              if (auto *UserBI = dyn_cast<BranchInst>(U))
+                ImpliedBranches.insert(UserBI);
+            toRemove.insert(Cmp);
+            replacements[Cmp] = Folded;
+            ++NumGVNImpliedConditions;
+            Changed = true;
+            continue;
+          }
+
       // For each instruction, look up its value number
       ValueNumber VN = VT.lookupOrAddValue(Inst);
 
+      // Values that are not numbered by this walk, like arguments, constants
+      // or the scalar behind a vector lane, are used when they dominate
+      Value *Earlier = lookupLeader(Leaders, VN, Inst->getType());
+      if (!Earlier && VN == 0)
+        Earlier = Constant::getNullValue(Inst->getType());
+      if (!Earlier) {
+        Value *First = VT.numberToValue.lookup(VN);
+        Instruction *FirstInst = dyn_cast_or_null<Instruction>(First);
+        if (First && First != Inst && First->getType() == Inst->getType() &&
+            (!FirstInst || DT.dominates(FirstInst, Inst)))
+          Earlier = First;
+      }
+
+      // In local mode, values computed in other blocks are not reused; the
+      // instruction becomes the leader of its own block instead
+      if (FnOptions.LocalOnly)
+        if (Instruction *EarlierInst = dyn_cast_or_null<Instruction>(Earlier))
+          if (EarlierInst->getParent() != BB)
+            Earlier = nullptr;
+
+      // The first instruction seen with a number becomes its leader
+      if (!Earlier) {
+        Leaders.insert(VN, Inst);
+        continue;
+      }
+
       // If we found a redundant instruction
-      if (VT.numberToValue.count(VN) && VT.numberToValue[VN] != Inst) {
-        Value *Earlier = VT.numberToValue[VN];
-        if (Earlier != Inst && isa<Instruction>(Earlier)) {
-          // Use dominator tree to ensure the replacement dominates the uses
-          Instruction *EarlierInst = cast<Instruction>(Earlier);
-          if (DT.dominates(EarlierInst, Inst)) {
-            llvm::outs() << "Found redundant instruction: " << *Inst
-                        << "\n  Can be replaced with: " << *Earlier << "\n";
-            // Mark instruction for later removal
-            toRemove.insert(Inst);
-            replacements[Inst] = Earlier;
-            ++NumGVNRedundant;
-            Changed = true;
-          }
-        }
+      if (Earlier != Inst) {
+        if (Verbose)
+          llvm::outs() << "Found redundant instruction: " << *Inst
+                      << "\n  Can be replaced with: " << *Earlier << "\n";
+        // Mark instruction for later removal
+        toRemove.insert(Inst);
+        replacements[Inst] = Earlier;
+        ++NumGVNRedundant;
+        Changed = true;
       }
     }
   }
 
-  // Replace redundant instructions with their equivalents
+  // Hoisting stages only move code where it is not executed more often
+  if (FnOptions.LoopHoist || FnOptions.Hoist) {
+    // Optionally move loop-invariant congruent expressions out of loops
+    if (FnOptions.LoopHoist) {
+      ProfitabilityModel Profit(FAM.getResult<BlockFrequencyAnalysis>(F));
+      LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
+      Changed |= hoistLoopInvariantCongruences(LI, VT, Profit, toRemove,
+                                               replacements, Verbose);
+    }
+
+    // Optionally merge values computed by every successor of a branch
+    if (FnOptions.Hoist &&
+        hoistFromSiblingBranches(DT, VT, toRemove, replacements, Verbose)) {
+      removeRedundantPHIs(F, DT, toRemove, replacements, Verbose);
+      Changed = true;
+    }
+  }
+
+  // No alias query is made past this point, and instructions are freed
+  // below. The batched results must not outlive the IR they describe.
+  VT.BatchAA = nullptr;
+  BatchAA.reset();
+
+  // Replace redundant instructions with their equivalents. Replacements are
+  // resolved first, since a replacement may itself have been removed. The
+  // surviving instruction may only keep the flags and metadata (!range,
+  // !nonnull, !tbaa, !noundef, ...) that hold for every value it replaces.
   for (Instruction *I : toRemove) {
     // Before removing, replace uses of the instruction
     if (replacements.count(I)) {
-      llvm::outs() << "Replacing: " << *I
-                  << "\n  With: " << *replacements[I] << "\n";
-      I->replaceAllUsesWith(replacements[I]);
-      I->eraseFromParent();
+      Value *Repl = getFinalReplacement(I, replacements);
+      if (Verbose)
+        llvm::outs() << "Replacing: " << *I << "\n  With: " << *Repl << "\n";
+      patchReplacementInstruction(I, Repl);
+      I->replaceAllUsesWith(Repl);
     }
   }
+  for (Instruction *I : toRemove)
+    if (replacements.count(I))
+      salvageDebugInfoAndErase(I);
+  for (Value *Ptr : DeadForwardPointers)
+    RecursivelyDeleteTriviallyDeadInstructions(Ptr);
+
+  // Branches on a folded condition now have a single destination. The
+  // condition they no longer use goes too when nothing else uses it.
+  for (const auto &Decided : DecidedBranches) {
+    BranchInst *BI = Decided.first;
+    Value *OldCond = BI->getCondition();
+    BI->setCondition(ConstantInt::getBool(BI->getContext(), Decided.second));
+    RecursivelyDeleteTriviallyDeadInstructions(OldCond);
+    ImpliedBranches.insert(BI);
+  }
+  if (!ImpliedBranches.empty()) {
+    DomTreeUpdater DTU(DT, DomTreeUpdater::UpdateStrategy::Eager);
+    for (BranchInst *BI : ImpliedBranches)
+      if (isa<Constant>(BI->getCondition())) {
+        if (Verbose)
+          llvm::outs() << "Folding branch: " << *BI << "\n";
+        ConstantFoldTerminator(BI->getParent(), /*DeleteDeadConditions=*/true,
+                               nullptr, &DTU);
+      }
+  }
+
+  // Optionally sink computations duplicated across the predecessors of a
+  // merge block. This works on the cleaned-up IR, since it compares operands
+  // rather than value numbers.
+  if (FnOptions.Sink)
+    Changed |= sinkToCommonSuccessors(F, DT, Verbose);
 
   // Print statistics
-  if (Changed) {
-    outs() << "GVN pass: processed " << NumGVNInstructions
-           << " instructions, removed " << NumGVNRedundant
-           << " redundant computations.\n";
-  } else {
-    outs() << "GVN pass: no changes made.\n";
+  if (Verbose) {
+    if (Changed) {
+      outs() << "GVN pass: processed " << NumGVNInstructions
+             << " instructions, removed " << NumGVNRedundant
+             << " redundant computations.\n";
+    } else {
+      outs() << "GVN pass: no changes made.\n";
+    }
   }
 
   // If the function was changed, invalidate analyses
@@ -423,25 +2681,181 @@ PreservedAnalyses GVN::run(Function &F, FunctionAnalysisManager &FAM) {
   return PreservedAnalyses::all();
 }
 
+//------------------------------------------------------------------------------
+// Library entry point
+//------------------------------------------------------------------------------
+bool runGVNOnModule(Module &M, const GVNOptions &Options) {
+  // A private set of analysis managers, so that callers like a JIT need no
+  // pass pipeline of their own
+  PassBuilder PB;
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+  // Make the profile summary available to the cold function check
+  MAM.getResult<ProfileSummaryAnalysis>(M);
+
+  GVN Pass(Options);
+  bool Changed = false;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    PreservedAnalyses PA = Pass.run(F, FAM);
+    FAM.invalidate(F, PA);
+    Changed |= !PA.areAllPreserved();
+  }
+  return Changed;
+}
+
 //------------------------------------------------------------------------------
 // New PM Registration
 //------------------------------------------------------------------------------
+// Parse the parameters of demo-gvn<...>, e.g. "loop-hoist;hoist", on top of
+// the given defaults
+Expected<GVNOptions> parseGVNOptions(StringRef Params, GVNOptions Options) {
+  while (!Params.empty()) {
+    StringRef Param;
+    std::tie(Param, Params) = Params.split(';');
+    bool Enable = !Param.consume_front("no-");
+
+    if (Param == "loop-hoist")
+      Options.LoopHoist = Enable;
+    else if (Param == "hoist")
+      Options.Hoist = Enable;
+    else if (Param == "sink")
+      Options.Sink = Enable;
+    else if (Param == "verbose")
+      Options.Verbose = Enable;
+    else if (Param == "local")
+      Options.LocalOnly = Enable;
+    else if (Param == "loads")
+      Options.NumberLoads = Enable;
+    else if (Param == "conditions")
+      Options.Conditions = Enable;
+    else if (Param.consume_front("engine=")) {
+      Optional<GVNEngine> Engine = StringSwitch<Optional<GVNEngine>>(Param)
+                                       .Case("none", GVNEngine::None)
+                                       .Case("sccp", GVNEngine::SCCP)
+                                       .Case("sccvn", GVNEngine::SCCVN)
+                                       .Case("partition",
+                                             GVNEngine::Partition)
+                                       .Default(None);
+      if (!Engine || !Enable)
+        return make_error<StringError>(
+            "invalid demo-gvn engine '" + Param.str() + "'",
+            inconvertibleErrorCode());
+      Options.Engine = *Engine;
+    }
+    else if (Param == "parallel")
+      Options.Parallel = Enable;
+    else if (Param == "quick" && Enable)
+      Options = GVNOptions::getQuick(Options.Verbose);
+    else
+      return make_error<StringError>(
+          "invalid demo-gvn pass parameter '" + Param.str() + "'",
+          inconvertibleErrorCode());
+  }
+  return Options;
+}
+
+// Match "demo-gvn" and "demo-gvn<params>", filling in the options
+static bool parseGVNPassName(StringRef Name, GVNOptions &Options) {
+  if (!Name.consume_front("demo-gvn"))
+    return false;
+  if (Name.empty())
+    return true;
+  if (!Name.consume_front("<") || !Name.consume_back(">"))
+    return false;
+
+  Expected<GVNOptions> Parsed = parseGVNOptions(Name);
+  if (!Parsed) {
+    errs() << toString(Parsed.takeError()) << "\n";
+    return false;
+  }
+  Options = *Parsed;
+  return true;
+}
+
+// Options of the instances inserted at extension points, parsed once from
+// -demo-gvn-ep-params. These run inside clang and are quiet by default.
+static GVNOptions getExtensionPointOptions() {
+  GVNOptions Defaults;
+  Defaults.Verbose = false;
+  Expected<GVNOptions> Parsed = parseGVNOptions(ExtensionPointParams, Defaults);
+  if (!Parsed)
+    report_fatal_error(Parsed.takeError());
+  return *Parsed;
+}
+
+// Add demo-gvn to the default pipelines at the extension point selected by
+// -demo-gvn-ep. Nothing is added at -O0, where no other scalar pass runs.
+static void registerExtensionPoints(PassBuilder &PB) {
+  switch (ExtensionPoint) {
+  case GVNExtensionPoint::None:
+    break;
+  case GVNExtensionPoint::ScalarOptimizerLate:
+    PB.registerScalarOptimizerLateEPCallback(
+        [](FunctionPassManager &FPM, OptimizationLevel Level) {
+          if (Level != OptimizationLevel::O0)
+            FPM.addPass(GVN(getExtensionPointOptions()));
+        });
+    break;
+  case GVNExtensionPoint::Peephole:
+    PB.registerPeepholeEPCallback(
+        [](FunctionPassManager &FPM, OptimizationLevel Level) {
+          if (Level != OptimizationLevel::O0)
+            FPM.addPass(GVN(getExtensionPointOptions()));
+        });
+    break;
+  case GVNExtensionPoint::FullLTOLast:
+#if LLVM_VERSION_MAJOR >= 16
+    PB.registerFullLinkTimeOptimizationLastEPCallback(
+        [](ModulePassManager &MPM, OptimizationLevel Level) {
+          if (Level != OptimizationLevel::O0)
+            MPM.addPass(createModuleToFunctionPassAdaptor(
+                GVN(getExtensionPointOptions())));
+        });
+#else
+    errs() << "demo-gvn: the full LTO extension point needs LLVM 16 or newer, "
+              "the pass is not added to the pipeline\n";
+#endif
+    break;
+  }
+}
+
 llvm::PassPluginLibraryInfo getGVNPluginInfo() {
   return {LLVM_PLUGIN_API_VERSION, "GVN", LLVM_VERSION_STRING,
           [](PassBuilder &PB) {
             // Register analysis dependencies
             PB.registerAnalysisRegistrationCallback(
-                [](FunctionAnalysisManager &FAM) {
+                [&PB](FunctionAnalysisManager &FAM) {
                   // Register the DominatorTree analysis pass
                   FAM.registerPass([&] { return DominatorTreeAnalysis(); });
+                  // Register the default alias analysis pipeline
+                  FAM.registerPass([&] { return PB.buildDefaultAAPipeline(); });
+                  // Register the analyses used by loop-hoist. Block
+                  // frequencies are computed from branch probabilities.
+                  FAM.registerPass([&] { return LoopAnalysis(); });
+                  FAM.registerPass([&] { return BlockFrequencyAnalysis(); });
+                  FAM.registerPass([&] { return BranchProbabilityAnalysis(); });
                 });
 
+            // Run inside the default -O1..-O3 and LTO pipelines, e.g. when
+            // loaded with clang -fpass-plugin
+            registerExtensionPoints(PB);
+
             // Register for function pass manager
             PB.registerPipelineParsingCallback(
                 [](StringRef Name, FunctionPassManager &FPM,
                    ArrayRef<PassBuilder::PipelineElement>) {
-                  if (Name == "demo-gvn") {
-                    FPM.addPass(GVN());
+                  GVNOptions Options;
+                  if (parseGVNPassName(Name, Options)) {
+                    FPM.addPass(GVN(Options));
                     return true;
                   }
                   return false;
@@ -451,8 +2865,10 @@ llvm::PassPluginLibraryInfo getGVNPluginInfo() {
             PB.registerPipelineParsingCallback(
                 [](StringRef Name, ModulePassManager &MPM,
                    ArrayRef<PassBuilder::PipelineElement>) {
-                  if (Name == "demo-gvn") {
-                    MPM.addPass(createModuleToFunctionPassAdaptor(GVN()));
+                  GVNOptions Options;
+                  if (parseGVNPassName(Name, Options)) {
+                    MPM.addPass(
+                        createModuleToFunctionPassAdaptor(GVN(Options)));
                     return true;
                   }
                   return false;
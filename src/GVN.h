@@ -14,8 +14,76 @@
 #define GVN_H
 
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/Error.h"
+
+//------------------------------------------------------------------------------
+// GVN Options
+//------------------------------------------------------------------------------
+// Numbering engines that can run before the dominator tree walk. Their
+// constants and congruences are applied to the function, and the walk then
+// finds what is left.
+enum class GVNEngine {
+  // none (default): the dominator tree walk only
+  None,
+  // sccp: constants, reachable blocks and congruences solved together,
+  // optimistically over the whole function (after Click)
+  SCCP,
+  // sccvn: SCC-based value numbering, optimistic only within the cycles of
+  // the SSA graph (after Simpson)
+  SCCVN,
+  // partition: the coarsest congruence by Hopcroft partition refinement
+  // (after Alpern, Wegman and Zadeck), without constant folding
+  Partition,
+};
+
+// Optional stages of the pass, selected in a pipeline with
+// demo-gvn<option;option...>. Prefixing an option with "no-" disables it.
+struct GVNOptions {
+  // loop-hoist: hoist loop-invariant expressions found congruent in several
+  // places of a loop body to the loop preheader
+  bool LoopHoist = false;
+  // hoist: hoist expressions computed by every successor of a branch into the
+  // branching block
+  bool Hoist = false;
+  // sink: sink the same operation computed by every predecessor of a merge
+  // block into the merge block, behind a PHI of the differing operand
+  bool Sink = false;
+  // verbose: print every redundancy found and every transformation made to
+  // stdout. Instances inserted at pipeline extension points are quiet unless
+  // asked otherwise.
+  bool Verbose = true;
+  // local: only reuse values computed earlier in the same block
+  bool LocalOnly = false;
+  // loads (on by default): number loads by the memory state they observe and
+  // forward loads from memset/memcpy. This is the only stage that needs
+  // alias analysis.
+  bool NumberLoads = true;
+  // conditions (on by default): fold compares implied by a dominating branch
+  // condition to constants, and the conditional branches using them
+  bool Conditions = true;
+  // engine=<name>: numbering engine whose results are applied before the
+  // dominator tree walk, see GVNEngine
+  GVNEngine Engine = GVNEngine::None;
+  // parallel (experimental): number the independent dominator subtrees of
+  // large functions on several threads before the main walk
+  bool Parallel = false;
+
+  // quick: the cheapest configuration, for compiles where latency matters
+  // more than code quality, e.g. the first tier of a JIT. Numbers values
+  // within each block only, leaves loads alone, folds no branches and moves
+  // no code.
+  static GVNOptions getQuick(bool Verbose = false) {
+    GVNOptions Options;
+    Options.Verbose = Verbose;
+    Options.LocalOnly = true;
+    Options.NumberLoads = false;
+    Options.Conditions = false;
+    return Options;
+  }
+};
 
 //------------------------------------------------------------------------------
 // GVN Pass
@@ -23,9 +91,26 @@
 // This class implements the Global Value Numbering optimization pass
 class GVN : public llvm::PassInfoMixin<GVN> {
 public:
+  GVN(GVNOptions Options = GVNOptions()) : Options(Options) {}
+
   // Main entry point - run GVN on a function
   llvm::PreservedAnalyses run(llvm::Function &F,
                              llvm::FunctionAnalysisManager &FAM);
+
+private:
+  GVNOptions Options;
 };
 
+//------------------------------------------------------------------------------
+// Library entry point
+//------------------------------------------------------------------------------
+// Run GVN on every function defined in M, outside of any pass pipeline, e.g.
+// from a JIT. Returns true if the module was changed.
+bool runGVNOnModule(llvm::Module &M, const GVNOptions &Options = GVNOptions());
+
+// Parse pass parameters in the syntax of demo-gvn<...>, e.g. "hoist;no-loads",
+// on top of the given defaults
+llvm::Expected<GVNOptions> parseGVNOptions(llvm::StringRef Params,
+                                           GVNOptions Options = GVNOptions());
+
 #endif // GVN_H
@@ -0,0 +1,661 @@
+//==============================================================================
+// FILE:
+//    GVNDriver.cpp
+//
+// DESCRIPTION:
+//    Standalone driver running demo-gvn over IR files without opt.
+//
+//    By default the input module is loaded whole, optimized and written to
+//    the output file.
+//
+//    With -stream, function bodies are read lazily from bitcode: each one is
+//    materialized, optimized, copied into an output shard and deleted again,
+//    so that peak memory is bounded by the largest function plus one shard
+//    instead of the whole module. Shards are written to the output directory
+//    as shard-<N>.bc once they reach -shard-size instructions, followed by
+//    globals.bc with the global variables, aliases and declarations. The
+//    aliases of a function go to its shard instead, as an alias must point
+//    to a definition. Local symbols are made hidden and external so the
+//    shards can refer to each other, and are listed in globals.bc. With
+//    -relink, the output directory is linked back into one module in which
+//    those symbols are local again.
+//
+//    With -batch, the input is a list of IR files, one per line, which are
+//    optimized in place by a pool of worker threads. Each worker owns an
+//    LLVMContext; inputs are memory-mapped and every result replaces its
+//    input atomically through a temporary file.
+//
+//    With -split=N, the module is divided into N partitions by SplitModule.
+//    Each partition is optimized in its own thread and LLVMContext, after a
+//    round trip through bitcode, and the partitions are linked back in
+//    partition order, so that the output does not depend on scheduling.
+//    Symbols that were local before the split are made local again.
+//
+// USAGE:
+//    gvn-driver [-gvn-params=<params>] <input> -o <output>
+//    gvn-driver -stream [-shard-size=<N>] <input.bc> -o <directory>
+//    gvn-driver -relink <directory> -o <output>
+//    gvn-driver -batch [-j=<N>] <file-list>
+//    gvn-driver -split=<N> <input> -o <output>
+//
+// License: MIT
+//==============================================================================
+#include "GVN.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+using namespace llvm;
+
+//------------------------------------------------------------------------------
+// Command line
+//------------------------------------------------------------------------------
+static cl::opt<std::string>
+    InputFilename(cl::Positional, cl::Required,
+                  cl::desc("<input IR file, or file list with -batch>"));
+
+static cl::opt<std::string>
+    OutputFilename("o", cl::init(""),
+                   cl::desc("Output file, or output directory with -stream"),
+                   cl::value_desc("path"));
+
+static cl::opt<std::string>
+    GVNParams("gvn-params", cl::init(""),
+              cl::desc("Parameters of the pass in the syntax of "
+                       "demo-gvn<...>, e.g. \"hoist;sink\""));
+
+static cl::opt<bool>
+    Stream("stream", cl::init(false),
+           cl::desc("Materialize, optimize and write out one function at a "
+                    "time, into shards in the output directory"));
+
+static cl::opt<bool>
+    Relink("relink", cl::init(false),
+           cl::desc("Link the shards written by -stream to the input "
+                    "directory back into one module"));
+
+static cl::opt<unsigned>
+    ShardSize("shard-size", cl::init(100000),
+              cl::desc("Number of instructions after which a shard is "
+                       "written out with -stream (default = 100000)"));
+
+static cl::opt<bool>
+    Batch("batch", cl::init(false),
+          cl::desc("Optimize in place every IR file listed in the input, one "
+                   "path per line"));
+
+static cl::opt<unsigned>
+    NumThreads("j", cl::init(0),
+               cl::desc("Number of worker threads with -batch "
+                        "(default = one per hardware thread)"));
+
+static cl::opt<unsigned>
+    NumPartitions("split", cl::init(0),
+                  cl::desc("Split the module into this many partitions, "
+                           "optimized in parallel and linked back"));
+
+static ExitOnError ExitOnErr;
+
+static GVNOptions getGVNOptions() {
+  GVNOptions Defaults;
+  Defaults.Verbose = false;
+  return ExitOnErr(parseGVNOptions(GVNParams, Defaults));
+}
+
+static void writeBitcode(const Module &M, StringRef Filename) {
+  if (verifyModule(M, &errs())) {
+    errs() << "gvn-driver: invalid module written to " << Filename << "\n";
+    exit(1);
+  }
+  std::error_code EC;
+  ToolOutputFile Out(Filename, EC, sys::fs::OF_None);
+  if (EC) {
+    errs() << "gvn-driver: " << Filename << ": " << EC.message() << "\n";
+    exit(1);
+  }
+  WriteBitcodeToFile(M, Out.os());
+  Out.keep();
+}
+
+// Symbols of the input that had local linkage, with that linkage. Stream
+// and split mode make them external while the module is in pieces.
+using LocalSymbols =
+    std::vector<std::pair<std::string, GlobalValue::LinkageTypes>>;
+
+// Give the definitions of Locals in M their local linkage back
+static void restoreLocalSymbols(Module &M, const LocalSymbols &Locals) {
+  for (const auto &Local : Locals) {
+    GlobalValue *GV = M.getNamedValue(Local.first);
+    if (!GV || GV->isDeclaration())
+      continue;
+    GV->setLinkage(Local.second);
+    GV->setVisibility(GlobalValue::DefaultVisibility);
+  }
+}
+
+//------------------------------------------------------------------------------
+// Whole-module mode
+//------------------------------------------------------------------------------
+static void runWholeModule() {
+  LLVMContext Ctx;
+  SMDiagnostic Err;
+  std::unique_ptr<Module> M = parseIRFile(InputFilename, Err, Ctx);
+  if (!M) {
+    Err.print("gvn-driver", errs());
+    exit(1);
+  }
+  runGVNOnModule(*M, getGVNOptions());
+  writeBitcode(*M, OutputFilename);
+}
+
+//------------------------------------------------------------------------------
+// Streaming mode
+//------------------------------------------------------------------------------
+// Named metadata of globals.bc recording the symbols that were local in the
+// input, so that -relink can make them local again
+static const char *const StreamLocalsMD = "gvn.stream.locals";
+
+// Give local symbols external linkage and hidden visibility, as SplitModule
+// does, so that a function moved to another shard can still refer to them
+static LocalSymbols externalizeLocalSymbols(Module &M) {
+  LocalSymbols Locals;
+  for (GlobalValue &GV : M.global_values()) {
+    if (!GV.hasLocalLinkage())
+      continue;
+    if (!GV.hasName())
+      GV.setName("__gvn_stream_unnamed");
+    Locals.emplace_back(GV.getName().str(), GV.getLinkage());
+    GV.setLinkage(GlobalValue::ExternalLinkage);
+    GV.setVisibility(GlobalValue::HiddenVisibility);
+  }
+  return Locals;
+}
+
+static void recordLocalSymbols(Module &M, const LocalSymbols &Locals) {
+  LLVMContext &Ctx = M.getContext();
+  NamedMDNode *MD = M.getOrInsertNamedMetadata(StreamLocalsMD);
+  for (const auto &Local : Locals)
+    MD->addOperand(MDNode::get(
+        Ctx, {MDString::get(Ctx, Local.first),
+              ConstantAsMetadata::get(ConstantInt::get(
+                  Type::getInt32Ty(Ctx), unsigned(Local.second)))}));
+}
+
+// Read back and drop the record of recordLocalSymbols
+static LocalSymbols takeLocalSymbols(Module &M) {
+  LocalSymbols Locals;
+  NamedMDNode *MD = M.getNamedMetadata(StreamLocalsMD);
+  if (!MD)
+    return Locals;
+  for (MDNode *Local : MD->operands())
+    Locals.emplace_back(
+        cast<MDString>(Local->getOperand(0))->getString().str(),
+        GlobalValue::LinkageTypes(
+            mdconst::extract<ConstantInt>(Local->getOperand(1))
+                ->getZExtValue()));
+  M.eraseNamedMetadata(MD);
+  return Locals;
+}
+
+// Create a declaration of GV in M, with the name of GV unless M already
+// has a symbol of that name
+static GlobalValue *createDeclaration(const GlobalValue &GV, Module &M) {
+  GlobalValue *Decl;
+  if (auto *FTy = dyn_cast<FunctionType>(GV.getValueType())) {
+    Function *F = Function::Create(FTy, GlobalValue::ExternalLinkage,
+                                   GV.getAddressSpace(), GV.getName(), &M);
+    if (const Function *Orig = dyn_cast<Function>(&GV)) {
+      F->setAttributes(Orig->getAttributes());
+      F->setCallingConv(Orig->getCallingConv());
+    }
+    Decl = F;
+  } else {
+    const GlobalVariable *Orig = dyn_cast<GlobalVariable>(&GV);
+    Decl = new GlobalVariable(
+        M, GV.getValueType(), Orig && Orig->isConstant(),
+        GlobalValue::ExternalLinkage, nullptr, GV.getName(), nullptr,
+        GV.getThreadLocalMode(), GV.getAddressSpace());
+  }
+  Decl->setVisibility(GV.getVisibility());
+  Decl->setDLLStorageClass(GV.getDLLStorageClass());
+  return Decl;
+}
+
+// Declare GV of the input module in a shard, unless it already has a
+// symbol of that name
+static GlobalValue *declareInShard(const GlobalValue &GV, Module &Shard) {
+  if (GlobalValue *Existing = Shard.getNamedValue(GV.getName()))
+    return Existing;
+  return createDeclaration(GV, Shard);
+}
+
+// Maps references to other global values to declarations in the shard
+class ShardMaterializer : public ValueMaterializer {
+public:
+  ShardMaterializer(Module &Shard) : Shard(Shard) {}
+
+  Value *materialize(Value *V) override {
+    if (GlobalValue *GV = dyn_cast<GlobalValue>(V))
+      return declareInShard(*GV, Shard);
+    return nullptr;
+  }
+
+private:
+  Module &Shard;
+};
+
+// Module of the output receiving optimized functions until it is full
+class Shard {
+public:
+  Shard(const Module &Source, unsigned Index)
+      : M(std::make_unique<Module>(
+            ("shard-" + Twine(Index)).str(), Source.getContext())),
+        Materializer(*M) {
+    M->setSourceFileName(Source.getSourceFileName());
+    M->setDataLayout(Source.getDataLayout());
+    M->setTargetTriple(Source.getTargetTriple());
+    if (NamedMDNode *Flags = Source.getModuleFlagsMetadata()) {
+      NamedMDNode *ShardFlags = M->getOrInsertModuleFlagsMetadata();
+      for (MDNode *Flag : Flags->operands())
+        ShardFlags->addOperand(Flag);
+    }
+  }
+
+  // Copy the body of F into the shard, together with the aliases of F
+  void add(Function &F, ArrayRef<GlobalAlias *> Aliases) {
+    Function *NewF = cast<Function>(declareInShard(F, *M));
+    NewF->setLinkage(F.getLinkage());
+    NewF->setVisibility(F.getVisibility());
+    if (const Comdat *C = F.getComdat()) {
+      Comdat *NewC = M->getOrInsertComdat(C->getName());
+      NewC->setSelectionKind(C->getSelectionKind());
+      NewF->setComdat(NewC);
+    }
+
+    ValueToValueMapTy VMap;
+    VMap[&F] = NewF;
+    for (auto ArgPair : zip(F.args(), NewF->args())) {
+      std::get<1>(ArgPair).setName(std::get<0>(ArgPair).getName());
+      VMap[&std::get<0>(ArgPair)] = &std::get<1>(ArgPair);
+    }
+
+    // Every alias is created before any aliasee is mapped, since an alias
+    // may point to another one. A declaration left by an earlier function
+    // of the shard is replaced by the alias.
+    SmallVector<GlobalAlias *, 2> NewAliases;
+    for (GlobalAlias *GA : Aliases) {
+      GlobalAlias *NewGA = GlobalAlias::create(
+          GA->getValueType(), GA->getAddressSpace(), GA->getLinkage(), "",
+          M.get());
+      NewGA->copyAttributesFrom(GA);
+      if (GlobalValue *Existing = M->getNamedValue(GA->getName())) {
+        NewGA->takeName(Existing);
+        Existing->replaceAllUsesWith(NewGA);
+        Existing->eraseFromParent();
+      } else {
+        NewGA->setName(GA->getName());
+      }
+      NewAliases.push_back(NewGA);
+    }
+    for (auto AliasPair : zip(Aliases, NewAliases))
+      std::get<1>(AliasPair)->setAliasee(
+          MapValue(std::get<0>(AliasPair)->getAliasee(), VMap, RF_None,
+                   nullptr, &Materializer));
+    SmallVector<ReturnInst *, 8> Returns;
+    CloneFunctionInto(NewF, &F, VMap, CloneFunctionChangeType::DifferentModule,
+                      Returns, "", nullptr, nullptr, &Materializer);
+    NumInsts += NewF->getInstructionCount();
+  }
+
+  unsigned size() const { return NumInsts; }
+
+  // The finished shard. Cloning registers the compile units of the input
+  // even when no function carries debug info; an empty list is dropped.
+  Module &getModule() {
+    if (NamedMDNode *CUs = M->getNamedMetadata("llvm.dbg.cu"))
+      if (CUs->getNumOperands() == 0)
+        M->eraseNamedMetadata(CUs);
+    return *M;
+  }
+
+private:
+  std::unique_ptr<Module> M;
+  ShardMaterializer Materializer;
+  unsigned NumInsts = 0;
+};
+
+static void runStreaming() {
+  LLVMContext Ctx;
+  SMDiagnostic Err;
+  std::unique_ptr<Module> M = getLazyIRFileModule(InputFilename, Err, Ctx);
+  if (!M) {
+    Err.print("gvn-driver", errs());
+    exit(1);
+  }
+  ExitOnErr(M->materializeMetadata());
+  LocalSymbols Locals = externalizeLocalSymbols(*M);
+
+  if (std::error_code EC = sys::fs::create_directories(OutputFilename)) {
+    errs() << "gvn-driver: " << OutputFilename << ": " << EC.message()
+           << "\n";
+    exit(1);
+  }
+
+  // Analysis managers shared by all functions; the results of a function
+  // are dropped as soon as it is written out
+  PassBuilder PB;
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+  MAM.getResult<ProfileSummaryAnalysis>(*M);
+  GVN Pass(getGVNOptions());
+
+  // An alias must point to a definition, so the aliases of a function go
+  // to the shard defining it
+  DenseMap<const GlobalObject *, SmallVector<GlobalAlias *, 1>> Aliases;
+  for (GlobalAlias &GA : M->aliases())
+    if (isa_and_nonnull<Function>(GA.getAliaseeObject()))
+      Aliases[GA.getAliaseeObject()].push_back(&GA);
+
+  unsigned NumShards = 0;
+  unsigned NumFunctions = 0;
+  auto Current = std::make_unique<Shard>(*M, NumShards);
+  auto Flush = [&]() {
+    SmallString<128> Path(OutputFilename);
+    sys::path::append(Path, "shard-" + Twine(NumShards++) + ".bc");
+    writeBitcode(Current->getModule(), Path);
+    Current = std::make_unique<Shard>(*M, NumShards);
+  };
+
+  for (Function &F : *M) {
+    if (!F.isMaterializable())
+      continue;
+    ExitOnErr(F.materialize());
+
+    Pass.run(F, FAM);
+    FAM.clear(F, F.getName());
+
+    Current->add(F, Aliases.lookup(&F));
+    F.deleteBody();
+    F.setComdat(nullptr);
+    ++NumFunctions;
+
+    if (Current->size() >= ShardSize)
+      Flush();
+  }
+  if (Current->size() > 0)
+    Flush();
+
+  // What remains of the input are the global variables, the aliases of
+  // global variables and a declaration of every function and of every
+  // alias of a function
+  for (auto &Entry : Aliases)
+    for (GlobalAlias *GA : Entry.second) {
+      GlobalValue *Decl = createDeclaration(*GA, *M);
+      Decl->takeName(GA);
+      GA->replaceAllUsesWith(Decl);
+      GA->eraseFromParent();
+    }
+  recordLocalSymbols(*M, Locals);
+  SmallString<128> Path(OutputFilename);
+  sys::path::append(Path, "globals.bc");
+  writeBitcode(*M, Path);
+
+  outs() << "gvn-driver: wrote " << NumFunctions << " functions in "
+         << NumShards << " shards to " << OutputFilename << "\n";
+}
+
+// Link globals.bc and the shards of a -stream output directory back into
+// one module, in shard order, and make the symbols that were local in the
+// input local again
+static void runRelink() {
+  LLVMContext Ctx;
+  auto ReadFile = [&](StringRef Name) {
+    SmallString<128> Path(InputFilename);
+    sys::path::append(Path, Name);
+    SMDiagnostic Err;
+    std::unique_ptr<Module> M = parseIRFile(Path, Err, Ctx);
+    if (!M) {
+      Err.print("gvn-driver", errs());
+      exit(1);
+    }
+    return M;
+  };
+
+  std::unique_ptr<Module> Linked = ReadFile("globals.bc");
+  LocalSymbols Locals = takeLocalSymbols(*Linked);
+  for (unsigned Index = 0;; ++Index) {
+    std::string Name = ("shard-" + Twine(Index) + ".bc").str();
+    SmallString<128> Path(InputFilename);
+    sys::path::append(Path, Name);
+    if (!sys::fs::exists(Path))
+      break;
+    if (Linker::linkModules(*Linked, ReadFile(Name))) {
+      errs() << "gvn-driver: cannot link " << Path << "\n";
+      exit(1);
+    }
+  }
+
+  restoreLocalSymbols(*Linked, Locals);
+  writeBitcode(*Linked, OutputFilename);
+}
+
+//------------------------------------------------------------------------------
+// Batch mode
+//------------------------------------------------------------------------------
+// Optimize one file in place, in the format it was read in
+static Error processFileInPlace(StringRef Path, LLVMContext &Ctx,
+                                const GVNOptions &Options) {
+  // Bitcode is parsed straight from the mapped file. The textual parser
+  // needs a null-terminated buffer, so text is read again if need be.
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer = MemoryBuffer::getFile(
+      Path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+  if (!Buffer)
+    return createFileError(Path, Buffer.getError());
+  bool IsBitcode = isBitcode(
+      reinterpret_cast<const unsigned char *>((*Buffer)->getBufferStart()),
+      reinterpret_cast<const unsigned char *>((*Buffer)->getBufferEnd()));
+  if (!IsBitcode) {
+    Buffer = MemoryBuffer::getFile(Path, /*IsText=*/true);
+    if (!Buffer)
+      return createFileError(Path, Buffer.getError());
+  }
+
+  SMDiagnostic Diag;
+  std::unique_ptr<Module> M = parseIR((*Buffer)->getMemBufferRef(), Diag, Ctx);
+  if (!M)
+    return createStringError(inconvertibleErrorCode(), "%s:%d: %s",
+                             Path.str().c_str(), Diag.getLineNo(),
+                             Diag.getMessage().str().c_str());
+  Buffer->reset();
+
+  runGVNOnModule(*M, Options);
+  if (verifyModule(*M))
+    return createStringError(inconvertibleErrorCode(),
+                             "%s: demo-gvn produced an invalid module",
+                             Path.str().c_str());
+
+  // Write next to the input and rename over it, so that a failure never
+  // leaves a truncated file behind
+  SmallString<128> TempPath;
+  int FD;
+  if (std::error_code EC =
+          sys::fs::createUniqueFile(Path + ".gvn-%%%%%%", FD, TempPath))
+    return createFileError(Path, EC);
+  {
+    raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    if (IsBitcode)
+      WriteBitcodeToFile(*M, OS);
+    else
+      M->print(OS, nullptr);
+    OS.close();
+    if (OS.has_error()) {
+      std::error_code EC = OS.error();
+      OS.clear_error();
+      sys::fs::remove(TempPath);
+      return createFileError(TempPath, EC);
+    }
+  }
+  if (std::error_code EC = sys::fs::rename(TempPath, Path)) {
+    sys::fs::remove(TempPath);
+    return createFileError(Path, EC);
+  }
+  return Error::success();
+}
+
+static bool runBatch() {
+  std::unique_ptr<MemoryBuffer> List =
+      ExitOnErr(errorOrToExpected(MemoryBuffer::getFile(InputFilename,
+                                                        /*IsText=*/true)));
+  SmallVector<StringRef, 0> Lines;
+  List->getBuffer().split(Lines, '\n', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+  std::vector<std::string> Files;
+  for (StringRef Line : Lines)
+    if (!Line.trim().empty())
+      Files.push_back(Line.trim().str());
+
+  GVNOptions Options = getGVNOptions();
+  std::atomic<size_t> Next(0);
+  std::atomic<unsigned> NumFailed(0);
+  std::mutex ErrorsMutex;
+
+  // Workers take the next file from the list until it is exhausted
+  auto Worker = [&]() {
+    LLVMContext Ctx;
+    for (size_t I = Next++; I < Files.size(); I = Next++) {
+      if (Error E = processFileInPlace(Files[I], Ctx, Options)) {
+        std::lock_guard<std::mutex> Lock(ErrorsMutex);
+        logAllUnhandledErrors(std::move(E), errs(), "gvn-driver: ");
+        ++NumFailed;
+      }
+    }
+  };
+
+  unsigned Threads = NumThreads;
+  if (!Threads)
+    Threads = std::max(1u, std::thread::hardware_concurrency());
+  Threads = std::max<size_t>(1, std::min<size_t>(Threads, Files.size()));
+  std::vector<std::thread> Pool;
+  for (unsigned I = 1; I < Threads; ++I)
+    Pool.emplace_back(Worker);
+  Worker();
+  for (std::thread &T : Pool)
+    T.join();
+
+  outs() << "gvn-driver: optimized " << Files.size() - NumFailed << " of "
+         << Files.size() << " files with " << Threads << " threads\n";
+  return NumFailed == 0;
+}
+
+//------------------------------------------------------------------------------
+// Split mode
+//------------------------------------------------------------------------------
+static void runSplit() {
+  // Partitions travel between contexts as bitcode
+  std::vector<SmallString<0>> Partitions;
+  LocalSymbols Locals;
+  {
+    LLVMContext Ctx;
+    SMDiagnostic Err;
+    std::unique_ptr<Module> M = parseIRFile(InputFilename, Err, Ctx);
+    if (!M) {
+      Err.print("gvn-driver", errs());
+      exit(1);
+    }
+
+    // SplitModule gives local symbols external linkage so that partitions
+    // can refer to each other. Remember them to undo that after linking.
+    for (GlobalValue &GV : M->global_values())
+      if (GV.hasLocalLinkage() && GV.hasName())
+        Locals.emplace_back(GV.getName().str(), GV.getLinkage());
+
+    SplitModule(*M, NumPartitions, [&](std::unique_ptr<Module> Part) {
+      Partitions.emplace_back();
+      raw_svector_ostream OS(Partitions.back());
+      WriteBitcodeToFile(*Part, OS);
+    });
+  }
+
+  GVNOptions Options = getGVNOptions();
+  std::vector<std::thread> Threads;
+  for (SmallString<0> &Partition : Partitions)
+    Threads.emplace_back([&Options, &Partition]() {
+      LLVMContext Ctx;
+      std::unique_ptr<Module> M = ExitOnErr(
+          parseBitcodeFile(MemoryBufferRef(Partition, "partition"), Ctx));
+      runGVNOnModule(*M, Options);
+      Partition.clear();
+      raw_svector_ostream OS(Partition);
+      WriteBitcodeToFile(*M, OS);
+    });
+  for (std::thread &T : Threads)
+    T.join();
+
+  LLVMContext Ctx;
+  std::unique_ptr<Module> Linked;
+  for (SmallString<0> &Partition : Partitions) {
+    std::unique_ptr<Module> M = ExitOnErr(
+        parseBitcodeFile(MemoryBufferRef(Partition, "partition"), Ctx));
+    if (!Linked) {
+      Linked = std::move(M);
+      continue;
+    }
+    if (Linker::linkModules(*Linked, std::move(M))) {
+      errs() << "gvn-driver: cannot link the partitions back together\n";
+      exit(1);
+    }
+  }
+
+  restoreLocalSymbols(*Linked, Locals);
+  writeBitcode(*Linked, OutputFilename);
+}
+
+//------------------------------------------------------------------------------
+// Main
+//------------------------------------------------------------------------------
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "demo-gvn standalone driver\n");
+  ExitOnErr.setBanner(std::string(argv[0]) + ": ");
+
+  if (Batch)
+    return runBatch() ? 0 : 1;
+
+  if (OutputFilename.empty()) {
+    errs() << "gvn-driver: an output path is required (-o)\n";
+    return 1;
+  }
+  if (Stream)
+    runStreaming();
+  else if (Relink)
+    runRelink();
+  else if (NumPartitions > 0)
+    runSplit();
+  else
+    runWholeModule();
+  return 0;
+}
@@ -0,0 +1,182 @@
+//==============================================================================
+// FILE:
+//    GVNJIT.cpp
+//
+// DESCRIPTION:
+//    Runs an IR file in an ORC LLJIT, with demo-gvn applied to each module
+//    by an IRTransformLayer hook as the module is materialized. The tier is
+//    picked with -tier for the whole run: "quick" (block-local numbering, no
+//    loads, no code motion) when compile latency matters most, and "full"
+//    (every stage) when the generated code does. Nothing is re-compiled.
+//
+//    With -benchmark, the tool instead measures the JIT compile latency of
+//    the whole module with no GVN, the quick tier and the full tier.
+//
+// USAGE:
+//    gvn-jit [-tier=none|quick|full] [-entry=<function>] <input.ll>
+//    gvn-jit -benchmark [-repeat=<N>] <input.ll>
+//
+// License: MIT
+//==============================================================================
+#include "GVN.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include <chrono>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+//------------------------------------------------------------------------------
+// Command line
+//------------------------------------------------------------------------------
+enum class GVNTier { None, Quick, Full };
+
+static cl::opt<std::string> InputFilename(cl::Positional, cl::Required,
+                                          cl::desc("<input IR file>"));
+
+static cl::opt<GVNTier>
+    Tier("tier", cl::init(GVNTier::Quick),
+         cl::desc("GVN configuration applied to materialized modules"),
+         cl::values(clEnumValN(GVNTier::None, "none", "Do not run GVN"),
+                    clEnumValN(GVNTier::Quick, "quick",
+                               "Block-local numbering without loads "
+                               "(default)"),
+                    clEnumValN(GVNTier::Full, "full", "Every GVN stage")));
+
+static cl::opt<std::string>
+    EntryName("entry", cl::init("main"),
+              cl::desc("Function of type i32() to run (default = main)"));
+
+static cl::opt<bool>
+    Benchmark("benchmark", cl::init(false),
+              cl::desc("Measure the compile latency of every tier instead of "
+                       "running the entry function"));
+
+static cl::opt<unsigned>
+    Repeat("repeat", cl::init(10),
+           cl::desc("Number of compiles averaged per tier with -benchmark "
+                    "(default = 10)"));
+
+static ExitOnError ExitOnErr;
+
+//------------------------------------------------------------------------------
+// JIT setup
+//------------------------------------------------------------------------------
+// Options of a tier, or None when the tier does not run GVN
+static Optional<GVNOptions> getTierOptions(GVNTier T) {
+  switch (T) {
+  case GVNTier::None:
+    return None;
+  case GVNTier::Quick:
+    return GVNOptions::getQuick();
+  case GVNTier::Full: {
+    GVNOptions Options;
+    Options.Verbose = false;
+    Options.LoopHoist = Options.Hoist = Options.Sink = true;
+    return Options;
+  }
+  }
+  llvm_unreachable("unknown GVN tier");
+}
+
+// Create a JIT running GVN with the given options on every module before it
+// is compiled
+static std::unique_ptr<LLJIT> createJIT(Optional<GVNOptions> Options) {
+  std::unique_ptr<LLJIT> J = ExitOnErr(LLJITBuilder().create());
+
+  // Let JIT'ed code call into the C library
+  J->getMainJITDylib().addGenerator(
+      ExitOnErr(DynamicLibrarySearchGenerator::GetForCurrentProcess(
+          J->getDataLayout().getGlobalPrefix())));
+
+  if (Options)
+    J->getIRTransformLayer().setTransform(
+        [Options](ThreadSafeModule TSM, MaterializationResponsibility &)
+            -> Expected<ThreadSafeModule> {
+          TSM.withModuleDo([&](Module &M) { runGVNOnModule(M, *Options); });
+          return TSM;
+        });
+  return J;
+}
+
+static ThreadSafeModule loadModule(StringRef Filename) {
+  auto Ctx = std::make_unique<LLVMContext>();
+  SMDiagnostic Err;
+  std::unique_ptr<Module> M = parseIRFile(Filename, Err, *Ctx);
+  if (!M) {
+    Err.print("gvn-jit", errs());
+    exit(1);
+  }
+  return ThreadSafeModule(std::move(M), std::move(Ctx));
+}
+
+//------------------------------------------------------------------------------
+// Latency benchmark
+//------------------------------------------------------------------------------
+// Average time, in milliseconds, from adding the module to the JIT until
+// every function defined in it has been compiled
+static double measureCompileLatency(GVNTier T) {
+  double TotalMs = 0;
+  for (unsigned I = 0; I < Repeat; ++I) {
+    ThreadSafeModule TSM = loadModule(InputFilename);
+    std::vector<std::string> Names;
+    TSM.withModuleDo([&](Module &M) {
+      for (Function &F : M)
+        if (!F.isDeclaration() && !F.hasLocalLinkage())
+          Names.push_back(F.getName().str());
+    });
+
+    auto Start = std::chrono::steady_clock::now();
+    std::unique_ptr<LLJIT> J = createJIT(getTierOptions(T));
+    ExitOnErr(J->addIRModule(std::move(TSM)));
+    for (const std::string &Name : Names)
+      ExitOnErr(J->lookup(Name));
+    auto End = std::chrono::steady_clock::now();
+
+    TotalMs +=
+        std::chrono::duration<double, std::milli>(End - Start).count();
+  }
+  return TotalMs / std::max(1u, unsigned(Repeat));
+}
+
+static void runBenchmark() {
+  const std::pair<GVNTier, const char *> Tiers[] = {
+      {GVNTier::None, "none"}, {GVNTier::Quick, "quick"},
+      {GVNTier::Full, "full"}};
+
+  outs() << "tier         compile (ms)\n";
+  for (const auto &Entry : Tiers)
+    outs() << format("%-8s %16.3f\n", Entry.second,
+                     measureCompileLatency(Entry.first));
+}
+
+//------------------------------------------------------------------------------
+// Main
+//------------------------------------------------------------------------------
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  cl::ParseCommandLineOptions(argc, argv, "demo-gvn ORC JIT driver\n");
+  ExitOnErr.setBanner(std::string(argv[0]) + ": ");
+
+  if (Benchmark) {
+    runBenchmark();
+    return 0;
+  }
+
+  std::unique_ptr<LLJIT> J = createJIT(getTierOptions(Tier));
+  ExitOnErr(J->addIRModule(loadModule(InputFilename)));
+
+  auto Entry = ExitOnErr(J->lookup(EntryName));
+  auto *EntryFn = jitTargetAddressToFunction<int (*)()>(Entry.getAddress());
+  int Result = EntryFn();
+  outs() << EntryName << " returned " << Result << "\n";
+  return 0;
+}
@@ -0,0 +1,145 @@
+//==============================================================================
+// FILE:
+//    GVNTableBench.cpp
+//
+// DESCRIPTION:
+//    Scaling benchmark of the expression tables shared by the threads of
+//    demo-gvn<parallel> (see ConcurrentExpressionTable.h). Every thread looks
+//    up its share of a stream of expression-like keys, about half of which
+//    repeat an earlier key, in a fresh table. The lock-free table and the
+//    mutex-guarded DenseMap are timed with 1, 2, 4, ... up to -max-threads
+//    threads, and both must end up with the same number of distinct keys.
+//
+// USAGE:
+//    gvn-table-bench [-keys=<N>] [-max-threads=<N>] [-repeat=<N>]
+//
+// License: MIT
+//==============================================================================
+#include "ConcurrentExpressionTable.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/raw_ostream.h"
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace llvm;
+
+//------------------------------------------------------------------------------
+// Command line
+//------------------------------------------------------------------------------
+static cl::opt<unsigned>
+    NumKeys("keys", cl::init(1 << 20),
+            cl::desc("Number of lookups per run (default = 1048576)"));
+
+static cl::opt<unsigned>
+    MaxThreads("max-threads", cl::init(32),
+               cl::desc("Largest number of threads measured (default = 32)"));
+
+static cl::opt<unsigned>
+    Repeat("repeat", cl::init(5),
+           cl::desc("Number of runs per configuration, the fastest one is "
+                    "reported (default = 5)"));
+
+//------------------------------------------------------------------------------
+// Workload
+//------------------------------------------------------------------------------
+// Keys shaped like the expression strings of ValueTable: an opcode, a type
+// and operand numbers. Every other key repeats one drawn from the keys
+// before it, as congruent expressions do.
+static std::vector<std::string> createKeys() {
+  static const char *const Opcodes[] = {"add", "mul", "getelementptr", "icmp",
+                                        "load", "xor"};
+  std::vector<std::string> Keys;
+  Keys.reserve(NumKeys);
+  uint64_t State = 0x9E3779B97F4A7C15ULL;
+  for (unsigned I = 0; I < NumKeys; ++I) {
+    State ^= State << 13;
+    State ^= State >> 7;
+    State ^= State << 17;
+    if (I % 2 && !Keys.empty()) {
+      Keys.push_back(Keys[State % Keys.size()]);
+      continue;
+    }
+    Keys.push_back(std::string(Opcodes[State % 6]) + " i64 " +
+                   utostr(State >> 40) + " " + utostr(I));
+  }
+  return Keys;
+}
+
+// Time, in milliseconds, for NumThreads threads to look up every key, each
+// one an interleaved share of them. Also returns the number of distinct keys.
+template <typename TableT>
+static double runTable(const std::vector<std::string> &Keys,
+                       unsigned NumThreads, size_t &NumInserted) {
+  TableT Table(1, Keys.size());
+  std::vector<BumpPtrAllocator> Arenas(NumThreads);
+  std::vector<size_t> Inserted(NumThreads, 0);
+
+  auto Worker = [&](unsigned Id) {
+    for (size_t I = Id; I < Keys.size(); I += NumThreads) {
+      bool IsNew;
+      Table.getOrInsert(Keys[I], Arenas[Id], IsNew);
+      Inserted[Id] += IsNew;
+    }
+  };
+
+  auto Start = std::chrono::steady_clock::now();
+  std::vector<std::thread> Threads;
+  for (unsigned Id = 1; Id < NumThreads; ++Id)
+    Threads.emplace_back(Worker, Id);
+  Worker(0);
+  for (std::thread &T : Threads)
+    T.join();
+  auto End = std::chrono::steady_clock::now();
+
+  NumInserted = 0;
+  for (size_t N : Inserted)
+    NumInserted += N;
+  return std::chrono::duration<double, std::milli>(End - Start).count();
+}
+
+template <typename TableT>
+static double bestOf(const std::vector<std::string> &Keys, unsigned NumThreads,
+                     size_t &NumInserted) {
+  double BestMs = 0;
+  for (unsigned I = 0; I < std::max(1u, unsigned(Repeat)); ++I) {
+    double Ms = runTable<TableT>(Keys, NumThreads, NumInserted);
+    if (I == 0 || Ms < BestMs)
+      BestMs = Ms;
+  }
+  return BestMs;
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv,
+                              "demo-gvn concurrent expression table "
+                              "benchmark\n");
+
+  std::vector<std::string> Keys = createKeys();
+  outs() << "hardware threads: " << std::thread::hardware_concurrency()
+         << "\n";
+  outs() << "threads   lock-free (ms)    mutex (ms)   speedup\n";
+  bool Mismatch = false;
+  const unsigned Limit = std::max(1u, unsigned(MaxThreads));
+  for (unsigned NumThreads = 1; NumThreads <= Limit; NumThreads *= 2) {
+    size_t LockFreeKeys, LockedKeys;
+    double LockFreeMs =
+        bestOf<ConcurrentExpressionTable>(Keys, NumThreads, LockFreeKeys);
+    double LockedMs =
+        bestOf<LockedExpressionTable>(Keys, NumThreads, LockedKeys);
+    outs() << format("%7u %16.3f %13.3f %8.2fx\n", NumThreads, LockFreeMs,
+                     LockedMs, LockFreeMs > 0 ? LockedMs / LockFreeMs : 0.0);
+    if (LockFreeKeys != LockedKeys) {
+      errs() << "gvn-table-bench: " << LockFreeKeys
+             << " distinct keys in the lock-free table with " << NumThreads
+             << " threads, expected " << LockedKeys << "\n";
+      Mismatch = true;
+    }
+  }
+  return Mismatch ? 1 : 0;
+}
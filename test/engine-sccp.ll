@@ -0,0 +1,54 @@
+; The sccp engine solves constants, reachable blocks and congruences
+; together. A flag only set on a branch that is dead while the flag is zero
+; stays zero, and the branch goes. A flag set on a live branch is kept.
+
+; CHECK-LABEL: define i32 @dead_flag(
+; CHECK: loop:
+; CHECK-NOT: %f = phi
+; CHECK-NOT: icmp ne
+; CHECK: br label %latch
+; CHECK: exit:
+; CHECK-NEXT: ret i32 0
+
+define i32 @dead_flag(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %f = phi i32 [ 0, %entry ], [ %f.next, %latch ]
+  %t = icmp ne i32 %f, 0
+  br i1 %t, label %set, label %latch
+set:
+  br label %latch
+latch:
+  %f.next = phi i32 [ 1, %set ], [ %f, %loop ]
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret i32 %f.next
+}
+
+; CHECK-LABEL: define i32 @live_flag(
+; CHECK: %f = phi i32 [ 0, %entry ], [ %f.next, %latch ]
+; CHECK: %f.next = phi i32 [ 1, %set ], [ %f, %loop ]
+; CHECK: exit:
+; CHECK-NEXT: ret i32 %f.next
+
+define i32 @live_flag(i32 %n, i1 %b) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %f = phi i32 [ 0, %entry ], [ %f.next, %latch ]
+  br i1 %b, label %set, label %latch
+set:
+  br label %latch
+latch:
+  %f.next = phi i32 [ 1, %set ], [ %f, %loop ]
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret i32 %f.next
+}
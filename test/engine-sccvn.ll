@@ -0,0 +1,70 @@
+; The sccvn engine iterates each cycle of the SSA graph optimistically, so
+; two induction variables feeding each other are merged. It does not relate
+; separate cycles, so two independent induction variables with the same
+; start and step stay apart (engine=partition or engine=sccp merge them),
+; and it finds no dead branches.
+
+; CHECK-LABEL: define i32 @crossed_ivs(
+; CHECK: %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+; CHECK-NOT: %j
+; CHECK: %d = sub i32 %i.next, %i.next
+
+define i32 @crossed_ivs(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %j.next, %loop ]
+  %j = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %i.next = add i32 %i, 1
+  %j.next = add i32 %j, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  %d = sub i32 %i.next, %j.next
+  ret i32 %d
+}
+
+; CHECK-LABEL: define i32 @two_ivs(
+; CHECK: %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+; CHECK-NEXT: %j = phi i32 [ 0, %entry ], [ %j.next, %loop ]
+; CHECK: %d = sub i32 %i.next, %j.next
+
+define i32 @two_ivs(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %j = phi i32 [ 0, %entry ], [ %j.next, %loop ]
+  %i.next = add i32 %i, 1
+  %j.next = add i32 %j, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  %d = sub i32 %i.next, %j.next
+  ret i32 %d
+}
+
+; CHECK-LABEL: define i32 @dead_flag(
+; CHECK: %t = icmp ne i32 %f, 0
+; CHECK-NEXT: br i1 %t, label %set, label %latch
+; CHECK: exit:
+; CHECK-NEXT: ret i32 %f.next
+
+define i32 @dead_flag(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %f = phi i32 [ 0, %entry ], [ %f.next, %latch ]
+  %t = icmp ne i32 %f, 0
+  br i1 %t, label %set, label %latch
+set:
+  br label %latch
+latch:
+  %f.next = phi i32 [ 1, %set ], [ %f, %loop ]
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret i32 %f.next
+}
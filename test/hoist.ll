@@ -0,0 +1,43 @@
+; Sibling hoisting moves an expression computed by every successor of a
+; branch into the branching block. An expression computed by only one
+; successor stays where it is.
+
+; CHECK-LABEL: define i32 @both(
+; CHECK: entry:
+; CHECK-NEXT: %x = mul i32 %a, %b
+; CHECK-NEXT: br i1 %c
+; CHECK: %x1 = add i32 %x, 1
+; CHECK-NOT: mul
+; CHECK: %y2 = add i32 %x, 2
+
+define i32 @both(i1 %c, i32 %a, i32 %b) {
+entry:
+  br i1 %c, label %l, label %r
+l:
+  %x = mul i32 %a, %b
+  %x1 = add i32 %x, 1
+  ret i32 %x1
+r:
+  %y = mul i32 %a, %b
+  %y2 = add i32 %y, 2
+  ret i32 %y2
+}
+
+; CHECK-LABEL: define i32 @one_side(
+; CHECK: entry:
+; CHECK-NEXT: br i1 %c
+; CHECK: %x = mul i32 %a, %b
+; CHECK: %y = sub i32 %a, %b
+
+define i32 @one_side(i1 %c, i32 %a, i32 %b) {
+entry:
+  br i1 %c, label %l, label %r
+l:
+  %x = mul i32 %a, %b
+  %x1 = add i32 %x, 1
+  ret i32 %x1
+r:
+  %y = sub i32 %a, %b
+  %y2 = add i32 %y, 2
+  ret i32 %y2
+}
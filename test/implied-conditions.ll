@@ -0,0 +1,43 @@
+; A branch whose condition is implied by a dominating branch gets a single
+; destination, and its compare goes with it once nothing else uses it. A
+; compare the dominating branch does not decide stays.
+
+; CHECK-LABEL: define i32 @implied(
+; CHECK-NOT: icmp slt i32 %x, 20
+; CHECK: then:
+; CHECK-NEXT: br label %a
+
+define i32 @implied(i32 %x) {
+entry:
+  %d = icmp slt i32 %x, 20
+  %c = icmp slt i32 %x, 10
+  br i1 %c, label %then, label %exit
+then:
+  br i1 %d, label %a, label %b
+a:
+  ret i32 1
+b:
+  ret i32 2
+exit:
+  ret i32 0
+}
+
+; CHECK-LABEL: define i32 @not_implied(
+; CHECK: %d = icmp slt i32 %x, 5
+; CHECK: then:
+; CHECK-NEXT: br i1 %d, label %a, label %b
+
+define i32 @not_implied(i32 %x) {
+entry:
+  %d = icmp slt i32 %x, 5
+  %c = icmp slt i32 %x, 10
+  br i1 %c, label %then, label %exit
+then:
+  br i1 %d, label %a, label %b
+a:
+  ret i32 1
+b:
+  ret i32 2
+exit:
+  ret i32 0
+}
@@ -0,0 +1,89 @@
+; demo-gvn<loop-hoist> moves loop-invariant expressions computed in several
+; places of a loop to its preheader, one loop at a time.
+
+; Two sibling loops, each with its own invariant congruence.
+; CHECK-LABEL: define i32 @two_loops(
+; CHECK: entry:
+; CHECK-NEXT: [[X:%.*]] = mul i32 %a, %b
+; CHECK-NEXT: br label %l1
+; CHECK: l1.then:
+; CHECK-NEXT: br label %l1.latch
+; CHECK: l1.else:
+; CHECK-NEXT: br label %l1.latch
+; CHECK: %x = phi i32 [ [[X]], %l1.then ], [ [[X]], %l1.else ]
+; CHECK: mid:
+; CHECK-NEXT: [[Y:%.*]] = xor i32 %a, %n
+; CHECK-NEXT: br label %l2
+; CHECK: l2.then:
+; CHECK-NEXT: br label %l2.latch
+; CHECK: %y = phi i32 [ [[Y]], %l2.then ], [ [[Y]], %l2.else ]
+define i32 @two_loops(i32 %a, i32 %b, i32 %n) {
+entry:
+  br label %l1
+l1:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %l1.latch ]
+  %c = icmp slt i32 %i, 7
+  br i1 %c, label %l1.then, label %l1.else
+l1.then:
+  %x1 = mul i32 %a, %b
+  br label %l1.latch
+l1.else:
+  %x2 = mul i32 %a, %b
+  br label %l1.latch
+l1.latch:
+  %x = phi i32 [ %x1, %l1.then ], [ %x2, %l1.else ]
+  %i.next = add i32 %i, %x
+  %done = icmp sge i32 %i.next, %n
+  br i1 %done, label %mid, label %l1
+mid:
+  br label %l2
+l2:
+  %j = phi i32 [ 0, %mid ], [ %j.next, %l2.latch ]
+  %d = icmp slt i32 %j, 3
+  br i1 %d, label %l2.then, label %l2.else
+l2.then:
+  %y1 = xor i32 %a, %n
+  br label %l2.latch
+l2.else:
+  %y2 = xor i32 %a, %n
+  br label %l2.latch
+l2.latch:
+  %y = phi i32 [ %y1, %l2.then ], [ %y2, %l2.else ]
+  %j.next = add i32 %j, %y
+  %done2 = icmp sge i32 %j.next, %n
+  br i1 %done2, label %exit, label %l2
+exit:
+  %r = add i32 %i.next, %j.next
+  ret i32 %r
+}
+
+; Congruent expressions that depend on the induction variable stay in the
+; loop.
+; CHECK-LABEL: define i32 @variant(
+; CHECK: entry:
+; CHECK-NEXT: br label %loop
+; CHECK: l.then:
+; CHECK-NEXT: %v1 = mul i32 %i, %a
+; CHECK: l.else:
+; CHECK-NEXT: %v2 = mul i32 %i, %a
+define i32 @variant(i32 %a, i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %c = icmp slt i32 %i, 7
+  br i1 %c, label %l.then, label %l.else
+l.then:
+  %v1 = mul i32 %i, %a
+  br label %latch
+l.else:
+  %v2 = mul i32 %i, %a
+  br label %latch
+latch:
+  %v = phi i32 [ %v1, %l.then ], [ %v2, %l.else ]
+  %i.next = add i32 %i, %v
+  %done = icmp sge i32 %i.next, %n
+  br i1 %done, label %exit, label %loop
+exit:
+  ret i32 %i.next
+}
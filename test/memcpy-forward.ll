@@ -0,0 +1,29 @@
+; Loads of a memcpy destination are rewritten into loads of its source.
+; Two loads at different offsets of one memcpy must read different source
+; bytes, although the forwarded load of the first is redundant and deleted.
+
+; CHECK-LABEL: define i64 @two_offsets(
+; CHECK: %x = load i64, i64* %src.p
+; CHECK-NOT: load i64, i64* %dst
+; CHECK: [[GEP:%.*]] = getelementptr inbounds i8, i8* %src, i64 8
+; CHECK: [[PTR:%.*]] = bitcast i8* [[GEP]] to i64*
+; CHECK: [[B:%.*]] = load i64, i64* [[PTR]]
+; CHECK: %s1 = add i64 %x, %x
+; CHECK: %s2 = add i64 %s1, [[B]]
+
+declare void @llvm.memcpy.p0i8.p0i8.i64(i8*, i8*, i64, i1)
+
+define i64 @two_offsets(i8* %dst, i8* %src) {
+entry:
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* %dst, i8* %src, i64 16, i1 false)
+  %src.p = bitcast i8* %src to i64*
+  %x = load i64, i64* %src.p
+  %dst.p = bitcast i8* %dst to i64*
+  %a = load i64, i64* %dst.p
+  %dst.8 = getelementptr inbounds i8, i8* %dst, i64 8
+  %dst.8.p = bitcast i8* %dst.8 to i64*
+  %b = load i64, i64* %dst.8.p
+  %s1 = add i64 %x, %a
+  %s2 = add i64 %s1, %b
+  ret i64 %s2
+}
@@ -0,0 +1,59 @@
+; With parallel numbering forced on a small function, the subtrees below the
+; first branch are numbered on worker threads, and the result is that of the
+; sequential walk. Values in one subtree reuse those of the blocks above the
+; branch and of their own subtree; congruent values in sibling subtrees are
+; not merged, since neither dominates the other.
+
+; CHECK-LABEL: define i32 @subtrees(
+; CHECK: entry:
+; CHECK-NEXT: %m = mul i32 %a, %b
+; CHECK: l:
+; CHECK-NEXT: %x2 = add i32 %m, %a
+; CHECK-NEXT: br label %j
+; CHECK: r:
+; CHECK-NEXT: %y = add i32 %a, %b
+; CHECK-NEXT: br label %j
+; CHECK: %s = add i32 %p, %p
+
+define i32 @subtrees(i1 %c, i32 %a, i32 %b) {
+entry:
+  %m = mul i32 %a, %b
+  br i1 %c, label %l, label %r
+l:
+  %x = mul i32 %a, %b
+  %x2 = add i32 %x, %a
+  %x3 = add i32 %m, %a
+  br label %j
+r:
+  %y = add i32 %a, %b
+  %y2 = add i32 %a, %b
+  br label %j
+j:
+  %p = phi i32 [ %x2, %l ], [ %y, %r ]
+  %q = phi i32 [ %x3, %l ], [ %y2, %r ]
+  %s = add i32 %p, %q
+  ret i32 %s
+}
+
+; CHECK-LABEL: define i32 @siblings(
+; CHECK: l:
+; CHECK-NEXT: %x = sub i32 %a, %b
+; CHECK: r:
+; CHECK-NEXT: %y = sub i32 %a, %b
+; CHECK: %p = phi i32 [ %x, %l ], [ %y, %r ]
+
+define i32 @siblings(i1 %c, i32 %a, i32 %b) {
+entry:
+  br i1 %c, label %l, label %r
+l:
+  %x = sub i32 %a, %b
+  br label %j
+r:
+  %y = sub i32 %a, %b
+  br label %j
+j:
+  %p = phi i32 [ %x, %l ], [ %y, %r ]
+  %z = sub i32 %a, %b
+  %s = add i32 %p, %z
+  ret i32 %s
+}
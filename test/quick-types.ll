@@ -0,0 +1,36 @@
+; demo-gvn<quick> skips constant folding, so operations on null constants
+; reach the value table. Null constants of every type are numbered 0, and
+; the expression key must tell the result types apart.
+
+; CHECK-LABEL: define void @null_operands(
+; CHECK-NEXT: %a = urem <4 x i16> zeroinitializer, zeroinitializer
+; CHECK-NEXT: %b = urem <16 x i64> zeroinitializer, zeroinitializer
+; CHECK-NEXT: %c = icmp ugt <1 x i64> zeroinitializer, zeroinitializer
+; CHECK-NEXT: %d = icmp ugt i64 0, 0
+; CHECK-NEXT: store <4 x i16> %a, <4 x i16>* %p
+; CHECK-NEXT: store <16 x i64> %b, <16 x i64>* %q
+; CHECK-NEXT: store <1 x i1> %c, <1 x i1>* %r
+; CHECK-NEXT: store i1 %d, i1* %s
+define void @null_operands(<4 x i16>* %p, <16 x i64>* %q, <1 x i1>* %r,
+                           i1* %s) {
+  %a = urem <4 x i16> zeroinitializer, zeroinitializer
+  %b = urem <16 x i64> zeroinitializer, zeroinitializer
+  %c = icmp ugt <1 x i64> zeroinitializer, zeroinitializer
+  %d = icmp ugt i64 0, 0
+  store <4 x i16> %a, <4 x i16>* %p
+  store <16 x i64> %b, <16 x i64>* %q
+  store <1 x i1> %c, <1 x i1>* %r
+  store i1 %d, i1* %s
+  ret void
+}
+
+; The same operation on the same type is still merged within a block.
+; CHECK-LABEL: define <4 x i16> @same_type(
+; CHECK-NEXT: %a = urem <4 x i16> zeroinitializer, zeroinitializer
+; CHECK-NEXT: %r = add <4 x i16> %a, %a
+define <4 x i16> @same_type() {
+  %a = urem <4 x i16> zeroinitializer, zeroinitializer
+  %b = urem <4 x i16> zeroinitializer, zeroinitializer
+  %r = add <4 x i16> %a, %b
+  ret <4 x i16> %r
+}
@@ -0,0 +1,49 @@
+; Sinking replaces the same operation computed by every predecessor of a
+; merge block with one copy in the merge block, merging the one operand
+; that differs with a PHI. When two operands differ, nothing is sunk.
+
+; CHECK-LABEL: define i32 @one_operand(
+; CHECK: l:
+; CHECK-NEXT: br label %m
+; CHECK: r:
+; CHECK-NEXT: br label %m
+; CHECK: m:
+; CHECK-NEXT: [[P:%.*]] = phi i32 [ %a, %l ], [ %b, %r ]
+; CHECK-NEXT: %x = add i32 [[P]], %n
+; CHECK-NEXT: ret i32 %x
+
+define i32 @one_operand(i1 %c, i32 %a, i32 %b, i32 %n) {
+entry:
+  br i1 %c, label %l, label %r
+l:
+  %x = add i32 %a, %n
+  br label %m
+r:
+  %y = add i32 %b, %n
+  br label %m
+m:
+  %p = phi i32 [ %x, %l ], [ %y, %r ]
+  ret i32 %p
+}
+
+; CHECK-LABEL: define i32 @two_operands(
+; CHECK: l:
+; CHECK-NEXT: %x = add i32 %a, %n
+; CHECK: r:
+; CHECK-NEXT: %y = add i32 %b, %k
+; CHECK: m:
+; CHECK-NEXT: %p = phi i32 [ %x, %l ], [ %y, %r ]
+
+define i32 @two_operands(i1 %c, i32 %a, i32 %b, i32 %n, i32 %k) {
+entry:
+  br i1 %c, label %l, label %r
+l:
+  %x = add i32 %a, %n
+  br label %m
+r:
+  %y = add i32 %b, %k
+  br label %m
+m:
+  %p = phi i32 [ %x, %l ], [ %y, %r ]
+  ret i32 %p
+}
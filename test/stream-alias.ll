@@ -0,0 +1,45 @@
+; Stream mode moves the aliases of a function to the shard defining it,
+; since an alias must point to a definition, and declares them in
+; globals.bc. Relinking the shards gives back every alias, and local
+; symbols get their linkage back.
+
+; CHECK-DAG: @g = global i32 7
+; CHECK-DAG: @p = private global i32 5
+; CHECK-DAG: @gal = alias i32, i32* @g
+; CHECK-DAG: @al = alias i32 (i32), i32 (i32)* @f
+; CHECK-DAG: @al2 = internal alias i32 (i32), i32 (i32)* @al
+; CHECK-DAG: @cast = alias i8, bitcast (i32 (i32)* @f to i8*)
+; CHECK-DAG: define i32 @f(i32 %x)
+; CHECK-DAG: define i32 @main()
+; CHECK-DAG: define internal i32 @helper(i32 %x)
+
+@g = global i32 7
+@p = private global i32 5
+@gal = alias i32, i32* @g
+@al = alias i32 (i32), i32 (i32)* @f
+@al2 = internal alias i32 (i32), i32 (i32)* @al
+@cast = alias i8, bitcast (i32 (i32)* @f to i8*)
+
+define i32 @main() {
+  %r = call i32 @al(i32 3)
+  %s = call i32 @al2(i32 %r)
+  %p = bitcast i8* @cast to i32 (i32)*
+  %t = call i32 %p(i32 %s)
+  %v = load i32, i32* @gal
+  %u = add i32 %t, %v
+  %w = call i32 @helper(i32 %u)
+  ret i32 %w
+}
+
+define internal i32 @helper(i32 %x) {
+  %v = load i32, i32* @p
+  %r = add i32 %x, %v
+  ret i32 %r
+}
+
+define i32 @f(i32 %x) {
+  %a = add i32 %x, 1
+  %b = add i32 %x, 1
+  %c = add i32 %a, %b
+  ret i32 %c
+}
@@ -0,0 +1,39 @@
+; Below the edge of a single switch case, the switched value is the case
+; value, so code using it is constant-folded. A block reached by two cases
+; does not know the value. Below the default edge, an equality compare
+; against a case value is false; one against another value is kept.
+
+; CHECK-LABEL: define void @cases(
+; CHECK: three:
+; CHECK-NEXT: call void @use(i32 4)
+; CHECK: shared:
+; CHECK-NEXT: %b = add i32 %x, 1
+; CHECK-NEXT: call void @use(i32 %b)
+; CHECK: def:
+; CHECK-NEXT: call void @use1(i1 false)
+; CHECK-NEXT: %n = icmp eq i32 %x, 4
+; CHECK-NEXT: call void @use1(i1 %n)
+
+declare void @use(i32)
+declare void @use1(i1)
+
+define void @cases(i32 %x) {
+entry:
+  switch i32 %x, label %def [ i32 3, label %three
+                              i32 5, label %shared
+                              i32 7, label %shared ]
+three:
+  %a = add i32 %x, 1
+  call void @use(i32 %a)
+  ret void
+shared:
+  %b = add i32 %x, 1
+  call void @use(i32 %b)
+  ret void
+def:
+  %e = icmp eq i32 %x, 5
+  call void @use1(i1 %e)
+  %n = icmp eq i32 %x, 4
+  call void @use1(i1 %n)
+  ret void
+}
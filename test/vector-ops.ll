@@ -0,0 +1,74 @@
+; Shuffles and vector element operations are value numbered. Splats of one
+; scalar match however they are built, a shuffle matches its commuted form,
+; and extracting a lane whose scalar is known is that scalar. Shuffles with
+; different masks, including a mask with an undefined lane, stay apart, as
+; does an extract of a lane that is not known.
+
+; CHECK-LABEL: define <4 x i32> @splats(
+; CHECK: %a = shufflevector
+; CHECK-NOT: %b = shufflevector
+; CHECK: %r = add <4 x i32> %a, %a
+
+define <4 x i32> @splats(i32 %s) {
+entry:
+  %i0 = insertelement <4 x i32> undef, i32 %s, i32 0
+  %a = shufflevector <4 x i32> %i0, <4 x i32> undef, <4 x i32> zeroinitializer
+  %i2 = insertelement <4 x i32> poison, i32 %s, i32 2
+  %b = shufflevector <4 x i32> %i2, <4 x i32> poison, <4 x i32> <i32 2, i32 2, i32 2, i32 2>
+  %r = add <4 x i32> %a, %b
+  ret <4 x i32> %r
+}
+
+; CHECK-LABEL: define i32 @extract_known(
+; CHECK-NOT: extractelement
+; CHECK: %r = add i32 %s, %s
+
+define i32 @extract_known(<4 x i32> %v, i32 %s) {
+entry:
+  %i = insertelement <4 x i32> %v, i32 %s, i32 1
+  %e = extractelement <4 x i32> %i, i32 1
+  %r = add i32 %e, %s
+  ret i32 %r
+}
+
+; CHECK-LABEL: define <4 x i32> @commuted(
+; CHECK: %a = shufflevector
+; CHECK-NOT: %b = shufflevector
+; CHECK: %r = add <4 x i32> %a, %a
+
+define <4 x i32> @commuted(<4 x i32> %x, <4 x i32> %y) {
+entry:
+  %a = shufflevector <4 x i32> %x, <4 x i32> %y, <4 x i32> <i32 0, i32 4, i32 1, i32 5>
+  %b = shufflevector <4 x i32> %y, <4 x i32> %x, <4 x i32> <i32 4, i32 0, i32 5, i32 1>
+  %r = add <4 x i32> %a, %b
+  ret <4 x i32> %r
+}
+
+; CHECK-LABEL: define <4 x i32> @different_masks(
+; CHECK: %a = shufflevector
+; CHECK: %b = shufflevector
+; CHECK: %c = shufflevector
+; CHECK: %r = add <4 x i32> %a, %b
+; CHECK: %r2 = add <4 x i32> %r, %c
+
+define <4 x i32> @different_masks(<4 x i32> %x, <4 x i32> %y) {
+entry:
+  %a = shufflevector <4 x i32> %x, <4 x i32> %y, <4 x i32> <i32 0, i32 4, i32 1, i32 5>
+  %b = shufflevector <4 x i32> %x, <4 x i32> %y, <4 x i32> <i32 0, i32 4, i32 2, i32 5>
+  %c = shufflevector <4 x i32> %x, <4 x i32> %y, <4 x i32> <i32 0, i32 4, i32 undef, i32 5>
+  %r = add <4 x i32> %a, %b
+  %r2 = add <4 x i32> %r, %c
+  ret <4 x i32> %r2
+}
+
+; CHECK-LABEL: define i32 @unknown_lane(
+; CHECK: %e = extractelement <4 x i32> %i, i32 2
+; CHECK: %r = add i32 %e, %s
+
+define i32 @unknown_lane(<4 x i32> %v, i32 %s) {
+entry:
+  %i = insertelement <4 x i32> %v, i32 %s, i32 1
+  %e = extractelement <4 x i32> %i, i32 2
+  %r = add i32 %e, %s
+  ret i32 %r
+}